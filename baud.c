@@ -0,0 +1,110 @@
+/*
+ * baud.c
+ *  Velocidade da porta srie escolhida em funcionamento (ver baud.h)
+ */
+
+#include "hal.h"
+#include "baud.h"
+#include "serial.h"
+#include "timer.h"
+
+static uint16_t EEMEM ee_baud_rate = BAUD_DEFAULT; // Velocidade guardada em EEPROM (confirmada)
+
+uint16_t baud_rate = BAUD_DEFAULT;
+uint8_t baud_trial = 0;
+static uint16_t baud_saved = BAUD_DEFAULT; // Velocidade a que se volta se a atual no for confirmada
+static uint16_t baud_pending = 0; // Velocidade pedida, a aplicar depois de enviar a resposta (0 -> nenhuma)
+
+/* Erro (em 0.1%) de um divisor para "baud" bps com "samples" amostras por bit */
+static uint16_t divisor_error (uint32_t baud, uint8_t samples, uint16_t ubrr){
+  uint32_t actual = F_CPU / ((uint32_t)samples * (ubrr + 1));
+  uint32_t diff = (actual > baud) ? actual - baud : baud - actual;
+
+  return (diff * 1000 + baud / 2) / baud;
+}
+
+/* Divisor mais prximo para "samples" amostras por bit (0xFFFF se no existir) */
+static uint16_t nearest (uint32_t baud, uint8_t samples){
+  uint32_t div = (F_CPU / samples + baud / 2) / baud; // UBRR0+1, arredondado
+
+  return (div < 1 || div > 4096) ? 0xFFFF : div - 1;
+}
+
+/* Calcula o UBRR0 e o modo (u2x a 1 -> 8 amostras por bit) de menor
+ * erro para rate*100 bps. Devolve 0xFFFF se o erro for maior do que
+ * BAUD_MAX_ERROR */
+uint16_t baud_divisor (uint16_t rate, uint8_t *u2x){
+  uint32_t baud = (uint32_t)rate * 100;
+  uint16_t normal = nearest(baud, 16);
+  uint16_t fast = nearest(baud, 8);
+  uint16_t normal_error = (0xFFFF == normal) ? 0xFFFF : divisor_error(baud, 16, normal);
+  uint16_t fast_error = (0xFFFF == fast) ? 0xFFFF : divisor_error(baud, 8, fast);
+
+  if (rate < BAUD_MIN || rate > BAUD_MAX){
+    return 0xFFFF;
+  }
+  *u2x = fast_error < normal_error;
+  if ((*u2x ? fast_error : normal_error) > BAUD_MAX_ERROR){
+    return 0xFFFF;
+  }
+  return *u2x ? fast : normal;
+}
+
+/* Aplica uma velocidade (j validada) */
+static void apply (uint16_t rate){
+  uint8_t u2x;
+  uint16_t ubrr = baud_divisor(rate, &u2x);
+
+  hal_usart_baud(ubrr, u2x);
+  baud_rate = rate;
+}
+
+/* L a velocidade guardada em EEPROM e configura a porta srie */
+void baud_init (void){
+  uint16_t rate = eeprom_read_word(&ee_baud_rate);
+  uint8_t u2x;
+
+  if (0xFFFF == baud_divisor(rate, &u2x) || ((1<<CLOSE) | (1<<OPEN)) == hal_buttons()){
+    rate = BAUD_DEFAULT; // EEPROM apagada ou invlida, ou os dois botes premidos (recuperao)
+  }
+  baud_saved = rate;
+  apply(rate);
+}
+
+/* Pede a mudana para rate*100 bps (aplicada depois de enviar a resposta).
+ * Devolve 0 se a velocidade no for possvel com erro aceitvel */
+uint8_t baud_request (uint16_t rate){
+  uint8_t u2x;
+
+  if (0xFFFF == baud_divisor(rate, &u2x)){
+    return 0;
+  }
+  baud_pending = rate;
+  return 1;
+}
+
+/* Chegou uma trama vlida: a velocidade atual funciona e  guardada */
+void baud_confirm (void){
+  if (!baud_trial){
+    return;
+  }
+  baud_trial = 0;
+  timer_stop(TMR_BAUD);
+  baud_saved = baud_rate;
+  eeprom_update_word(&ee_baud_rate, baud_rate);
+}
+
+/* Muda de velocidade quando a transmisso termina e volta  anterior
+ * se a nova no for confirmada a tempo (chamada no ciclo principal) */
+void baud_poll (void){
+  if (baud_pending && usart_tx_idle()){ // A resposta j saiu toda  velocidade antiga
+    apply(baud_pending);
+    baud_pending = 0;
+    baud_trial = 1;
+    timer_start(TMR_BAUD, BAUD_CONFIRM_TIME);
+  }
+  else if (baud_trial && timer_expired(TMR_BAUD)){ // O computador no respondeu  nova velocidade
+    baud_trial = 0;
+    apply(baud_saved);
+  }
+}
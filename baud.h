@@ -0,0 +1,58 @@
+/*
+ * baud.h
+ *  Velocidade da porta srie escolhida em funcionamento
+ *
+ *  A velocidade  pedida em unidades de 100 bps (CMD_SET_BAUD) e o
+ *  divisor  calculado no momento: para cada modo (16 amostras por
+ *  bit, ou 8 com U2X0) o UBRR0 mais prximo (arredondado, em vez de
+ *  truncado) e o respetivo erro, ficando o modo com menor erro (em
+ *  caso de empate o normal, que amostra cada bit mais vezes). A 16MHz:
+ *    9600 - normal, UBRR0 = 103, erro 0.2%
+ *   57600 - U2X, UBRR0 = 34, erro 0.8% (era 2.1% sem U2X)
+ *  115200 - U2X, UBRR0 = 16, erro 2.1% (recusada, ver BAUD_MAX_ERROR)
+ *  250000, 500000, 1000000 - normal, UBRR0 = 3, 1, 0, sem erro
+ *  Velocidades com erro acima de BAUD_MAX_ERROR so recusadas.
+ *
+ *  Mudana de velocidade:
+ *   A resposta ao comando ainda  enviada  velocidade antiga; s
+ *   quando o ltimo bit sai  que muda (baud_poll()). A nova velocidade
+ *   fica  experincia: se em BAUD_CONFIRM_TIME ms no chegar uma
+ *   trama vlida (com CRC certo) volta  anterior, pelo que uma
+ *   velocidade que o computador (ou o adaptador) no consegue usar
+ *   nunca deixa a persiana incontactvel. S depois de confirmada 
+ *   guardada em EEPROM. Enquanto no for confirmada os comandos de um
+ *   s caracter so ignorados, para que lixo recebido a uma
+ *   velocidade errada nunca mova a persiana.
+ *   Com os dois botes premidos durante o arranque  usada
+ *   BAUD_DEFAULT, seja qual for a velocidade guardada (por isso
+ *   baud_init() s  chamada depois de configurar os pinos dos
+ *   botes).
+ */
+
+#ifndef BAUD_H_
+#define BAUD_H_
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL // Frequncia de relgio do processador
+#endif
+
+#define BAUD_DEFAULT 576 // 57600 bps (velocidade original, e usada com a EEPROM apagada)
+#define BAUD_MIN 12 // 1200 bps
+#define BAUD_MAX 20000 // 2 Mbps (F_CPU/8, UBRR0 = 0 com U2X)
+#ifndef BAUD_MAX_ERROR
+#define BAUD_MAX_ERROR 20 // Erro mximo aceite, em 0.1% (o total admissvel em 8N1  cerca de 4.5%, entre os dois lados)
+#endif
+#define BAUD_CONFIRM_TIME 5000 // ms para o computador confirmar a nova velocidade com uma trama vlida
+
+extern uint16_t baud_rate; // Velocidade atual (unidades de 100 bps)
+extern uint8_t baud_trial; // A velocidade atual ainda no foi confirmada
+
+uint16_t baud_divisor(uint16_t rate, uint8_t *u2x);
+void baud_init(void);
+uint8_t baud_request(uint16_t rate);
+void baud_confirm(void);
+void baud_poll(void);
+
+#endif /* BAUD_H_ */
@@ -0,0 +1,180 @@
+/*
+ * bench.c
+ *  Build de medio das latncias (ver bench.h). S existe na
+ *  firmware: usa o timer 1 e os pinos diretamente
+ */
+
+#include "hal.h"
+#include "bench.h"
+
+#if BENCH
+#include <avr/interrupt.h>
+#include "controller.h"
+#include "protocol.h"
+
+#if MOTOR_PWM
+#error "A build de medio usa o timer 1, que com MOTOR_PWM comanda o motor"
+#endif
+#if MOTOR != PB0
+#error "O pino do motor tem de ser ICP1 (PB0)"
+#endif
+
+// Caminhos medidos (ver bench.h)
+#define PATH_BUTTON 0 // Boto de abertura
+#define PATH_CHAR 1 // Caracter 'u'
+#define PATH_FRAME 2 // Trama com CMD_OPEN
+#define PATHS 3
+
+// Fases de uma medio
+#define BENCH_WAIT 0 // Aguarda a persiana parada
+#define BENCH_ARMED 1 // Pedido marcado no timer 1 (OCR1A), ou j feito,  espera do motor
+#define BENCH_DONE 2 // O motor ligou (instante em bench_t1)
+
+static const char path_names[PATHS] = {'b', 'c', 'f'};
+
+static volatile uint8_t bench_phase = BENCH_WAIT; // Fase da medio em curso
+static volatile uint16_t bench_ovf = 0; // Voltas do timer 1 (bits 16 a 31 do instante)
+static volatile uint32_t bench_t0; // Instante do pedido (contagens de 0.5us)
+static volatile uint32_t bench_t1; // Instante em que o motor ligou
+static uint8_t bench_path = PATH_BUTTON; // Caminho da medio em curso
+static uint8_t bench_crc; // ltimo byte da trama do caminho PATH_FRAME (colocado pela ISR)
+static uint8_t bench_seq = 0; // Nmero de sequncia das tramas
+static uint16_t bench_lfsr = 0xACE1; // Gerador dos instantes aleatrios
+static uint32_t bench_since = 0; // Incio da fase atual (ms)
+
+/* Instante de uma contagem do timer 1 lida agora, em 32 bits (s nas
+ * ISR, com as interrupes desligadas): uma volta ainda por contar
+ * em bench_ovf s conta se a contagem for de depois dela */
+static uint32_t stamp (uint16_t count){
+  uint16_t ovf = bench_ovf;
+
+  if ((TIFR1 & (1<<TOV1)) && count < 0x8000){
+    ovf++;
+  }
+  return ((uint32_t)ovf << 16) | count;
+}
+
+ISR (TIMER1_OVF_vect){
+  bench_ovf++;
+}
+
+ISR (TIMER1_COMPA_vect){ // Instante do pedido
+  TIMSK1 &= ~(1<<OCIE1A);
+  TIFR1 = (1<<ICF1); // S conta um flanco de depois do pedido
+  TIMSK1 |= (1<<ICIE1);
+  bench_t0 = stamp(TCNT1);
+  if (PATH_BUTTON == bench_path){ // Boto premido: o pino liga  massa
+    PORTD &= ~(1<<OPEN);
+    DDRD |= (1<<OPEN);
+  }
+  else {
+    rx_put((PATH_CHAR == bench_path) ? 'u' : bench_crc);
+  }
+}
+
+ISR (TIMER1_CAPT_vect){ // O motor ligou (flanco descendente de PB0)
+  bench_t1 = stamp(ICR1);
+  TIMSK1 &= ~(1<<ICIE1);
+  bench_phase = BENCH_DONE;
+}
+
+/* Coloca bytes no buffer de receo, como a ISR da porta srie */
+static void inject (const uint8_t *data, uint8_t len){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    while (len--){
+      rx_put(*data++);
+    }
+  }
+}
+
+/* Trama com um s comando, sem argumentos, para este n. Devolve o tamanho */
+static uint8_t frame (uint8_t *buf, uint8_t cmd){
+  uint8_t crc = 0;
+  uint8_t i;
+
+  buf[0] = PROTO_SOF;
+  buf[1] = bus_addr;
+  buf[2] = 1;
+  buf[3] = ++bench_seq; // (nunca igual  anterior, que seria uma retransmisso)
+  buf[4] = cmd;
+  for (i = 1; i < 5; i++){
+    crc = _crc8_ccitt_update(crc, buf[i]);
+  }
+  buf[5] = crc;
+  return 6;
+}
+
+/* Envia o resultado de uma medio e para a persiana */
+static void finish (uint8_t ok){
+  uint8_t buf[6];
+  uint32_t us = (bench_t1 - bench_t0) >> 1;
+
+  TIMSK1 &= ~((1<<OCIE1A) | (1<<ICIE1));
+  DDRD &= ~(1<<OPEN); // Larga o boto
+  PORTD |= (1<<OPEN);
+
+  usart_puts_P(PSTR("L "));
+  usart_tx_put(path_names[bench_path]);
+  usart_tx_put(' ');
+  if (ok){
+    usart_put_dec((us > 0xFFFF) ? 0xFFFF : us);
+  }
+  else {
+    usart_tx_put('T');
+  }
+  usart_tx_put('\n');
+
+  inject(buf, frame(buf, CMD_STOP));
+  bench_path = (bench_path + 1) % PATHS;
+  bench_since = millis();
+  bench_phase = BENCH_WAIT;
+}
+#endif
+
+/* Liga o timer 1 (0.5us por contagem) e anuncia a build */
+void bench_init (void){
+#if BENCH
+  TCCR1A = 0; // Modo normal
+  TCCR1B = (1<<CS11); // Prescaler 8, input capture no flanco descendente, sem filtro (que atrasaria 4 ciclos)
+  TIMSK1 = (1<<TOIE1);
+#ifdef DEBUG
+  usart_puts_P(PSTR("# bench debug=1\n"));
+#else
+  usart_puts_P(PSTR("# bench debug=0\n"));
+#endif
+#endif
+}
+
+/* Marca o prximo pedido com a persiana parada e envia as medies
+ * (chamada no ciclo principal) */
+void bench_poll (void){
+#if BENCH
+  uint8_t buf[6];
+  uint8_t phase = bench_phase;
+
+  if (BENCH_DONE == phase){
+    finish(1);
+  }
+  else if (BENCH_ARMED == phase){
+    if (millis() - bench_since > BENCH_TIMEOUT){ // O motor no ligou
+      finish(0);
+    }
+  }
+  else if (IDLE == state && !motor_on() && !position_moving() && millis() - bench_since >= BENCH_GAP){
+    position_set(MAX_HEIGHT / 2); // (para que haja sempre percurso para abrir)
+    if (PATH_FRAME == bench_path){ // A trama chega toda menos o CRC
+      frame(buf, CMD_OPEN);
+      bench_crc = buf[5];
+      inject(buf, 5);
+    }
+    bench_lfsr = (bench_lfsr >> 1) ^ (-(bench_lfsr & 1) & 0xB400); // LFSR de 16 bits (x^16+x^14+x^13+x^11+1)
+    bench_since = millis();
+    bench_phase = BENCH_ARMED;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      OCR1A = TCNT1 + 200 + (bench_lfsr & 0x7FF); // 0.1 a 1.1ms: percorre todo o ms do timer 2
+      TIFR1 = (1<<OCF1A);
+      TIMSK1 |= (1<<OCIE1A);
+    }
+  }
+#endif
+}
@@ -0,0 +1,52 @@
+/*
+ * bench.h
+ *  Build de medio das latncias (make BENCH=1): do boto ou da
+ *  porta srie at o motor ligar, medidas pela prpria placa
+ *
+ *  A firmware corre normalmente, mas com a persiana parada (IDLE) a
+ *  build de medio provoca, ela prpria, um pedido de abertura por
+ *  um de trs caminhos,  vez:
+ *   b - boto de abertura premido (o pino OPEN passa a sada a 0,
+ *       como o boto a ligar o pino  massa);
+ *   c - caracter 'u' recebido (colocado no buffer de receo como
+ *       pela ISR da porta srie);
+ *   f - trama com CMD_OPEN recebida (o ltimo byte, o CRC, 
+ *       colocado no buffer no instante da medio).
+ *  O instante do pedido  o do timer 1 (0.5us por contagem), e o
+ *  instante em que o motor liga  capturado pelo prprio timer 1
+ *  (input capture no flanco descendente de ICP1, que  o pino do
+ *  motor, PB0), sem depender do ciclo principal. Cada pedido  feito
+ *  num instante aleatrio dentro do ms do timer 2, para que as
+ *  medies cubram todas as fases da ISR. A persiana  depois parada
+ *  (trama com CMD_STOP) e reposta a meio do percurso.
+ *  Cada medio  enviada pela porta srie numa linha:
+ *   L <caminho> <us>    (ou "L <caminho> T" se o motor no ligou)
+ *  depois de uma linha "# bench debug=<0|1>" no arranque; o script
+ *  bench/latency.py junta as linhas e calcula a mediana, o p99 e o
+ *  mximo de cada caminho, com e sem DEBUG.
+ *  Cada medio volta a guardar a altura em EEPROM (4 bytes), pelo
+ *  que a build de medio no deve ficar a correr indefinidamente.
+ *  A latncia dos caracteres recebidos no inclui a transmisso do
+ *  caracter em si (10 bits  velocidade da porta srie), que no
+ *  depende da firmware.
+ *
+ *  Usa o timer 1, pelo que no pode ser compilada com MOTOR_PWM.
+ *  Sem BENCH as funes no fazem nada.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+
+#ifndef BENCH
+#define BENCH 0 // Build normal, sem medio das latncias
+#endif
+
+#define BENCH_GAP 200 // ms de persiana parada entre medies
+#define BENCH_TIMEOUT 500 // ms at uma medio ser dada como falhada
+
+void bench_init(void);
+void bench_poll(void);
+
+#endif /* BENCH_H_ */
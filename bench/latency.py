@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Button-to-motor and serial-to-motor latency report of the BENCH=1 build.
+
+The bench build (see bench.h) injects an open request on its own,
+alternating between the open button (b), the 'u' character (c) and a
+CMD_OPEN frame (f), timestamps the motor edge with timer 1 input capture
+and prints one "L <path> <us>" line per measurement. This script collects
+them from the serial port and prints the median, p99 and max of each path.
+
+    latency.py --port /dev/ttyACM0                 board already flashed
+    latency.py --port /dev/ttyACM0 --flash         build and flash with DEBUG
+                                                   off, then on, measuring each
+    latency.py --port /dev/ttyACM0 --max-p99 5     exit 1 if a p99 is above 5 ms
+
+Requires pyserial. The board runs its normal 14 s initialisation first.
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+import time
+
+import serial
+
+PATHS = {"b": "button", "c": "char 'u'", "f": "CMD_OPEN frame"}
+LINE = re.compile(rb"L ([bcf]) (\d+|T)\s*$")
+HEADER = re.compile(rb"# bench debug=([01])")
+
+
+def percentile(values, p):
+    """Nearest-rank percentile of a sorted list."""
+    rank = max(1, -(-len(values) * p // 100))
+    return values[rank - 1]
+
+
+def measure(port, baud, samples, timeout):
+    """{path: [us, ...]} and timeout counts, until every path has "samples" values."""
+    values = {k: [] for k in PATHS}
+    timeouts = {k: 0 for k in PATHS}
+    debug = None
+    deadline = time.monotonic() + timeout
+    with serial.Serial(port, baud, timeout=1) as ser:
+        while min(len(v) for v in values.values()) < samples:
+            if time.monotonic() > deadline:
+                sys.exit("timed out waiting for measurements (is the BENCH=1 build running?)")
+            line = ser.readline()
+            m = HEADER.search(line)
+            if m:
+                debug = m.group(1) == b"1"
+            m = LINE.search(line)  # (replies and DEBUG output share the line)
+            if not m:
+                continue
+            path = m.group(1).decode()
+            if m.group(2) == b"T":
+                timeouts[path] += 1
+            else:
+                values[path].append(int(m.group(2)))
+    return values, timeouts, debug
+
+
+def report(label, values, timeouts):
+    print(label)
+    print("  %-16s %6s %9s %9s %9s %8s" % ("path", "n", "median", "p99", "max", "timeouts"))
+    worst = 0
+    for k, name in PATHS.items():
+        v = sorted(values[k])
+        p99 = percentile(v, 99)
+        worst = max(worst, p99)
+        print("  %-16s %6d %7.3fms %7.3fms %7.3fms %8d" % (name, len(v), percentile(v, 50) / 1000, p99 / 1000, v[-1] / 1000, timeouts[k]))
+    return worst
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("--port", required=True)
+    p.add_argument("--baud", type=int, default=57600)
+    p.add_argument("--samples", type=int, default=300, help="measurements per path")
+    p.add_argument("--flash", action="store_true", help="make BENCH=1 flash, without and with DEBUG")
+    p.add_argument("--max-p99", type=float, help="fail if any p99 is above this (ms)")
+    args = p.parse_args()
+
+    runs = [("", "DEBUG off"), ("-DDEBUG", "DEBUG on")] if args.flash else [(None, None)]
+    worst = 0
+    failed = False
+    for defs, label in runs:
+        if defs is not None:
+            subprocess.run(["make", "-s", "BENCH=1", "DEFS=" + defs, "PORT=" + args.port, "flash"], check=True)
+        timeout = 20 + args.samples * len(PATHS) * 0.5  # initialisation, then about 0.3 s per measurement
+        values, timeouts, debug = measure(args.port, args.baud, args.samples, timeout)
+        if label is None:
+            label = "DEBUG %s" % ("on" if debug else "off" if debug is not None else "?")
+        worst = max(worst, report(label, values, timeouts))
+        failed = failed or any(timeouts.values())
+    if args.max_p99 is not None and worst > args.max_p99 * 1000:
+        print("p99 %.3f ms above the %.3f ms limit" % (worst / 1000, args.max_p99))
+        failed = True
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
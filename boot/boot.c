@@ -0,0 +1,147 @@
+/*
+ * boot.c
+ *  Bootloader: escolhe a imagem da firmware a executar (A/B) e
+ *  escreve a flash a pedido da firmware (ver boot.h)
+ *
+ *  No arranque:
+ *   1. guarda a causa do reset e desliga o watchdog;
+ *   2. l o registo de arranque da EEPROM (invlido -> imagem A);
+ *   3. se h uma imagem nova em experincia e ainda lhe restam
+ *      arranques, entra nela (e desconta um); seno esquece-a e
+ *      entra na imagem confirmada;
+ *   4. se a imagem escolhida no confere com o CRC do registo (ou
+ *      est apagada) e a outra confere, entra na outra;
+ *   5. passa as interrupes para a tabela da seco de arranque e
+ *      salta para o incio da imagem.
+ *  No usa interrupes nem variveis globais: a tabela de vetores 
+ *  apenas a passagem para a da imagem em execuo.
+ *
+ *  Compilado  parte (boot/Makefile), para a seco de arranque, com
+ *  boot_write_page() na seco .bootapi, em BOOT_API_WRITE.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include "boot.h"
+
+#if SPM_PAGESIZE != BOOT_PAGE_SIZE
+#error "BOOT_PAGE_SIZE tem de ser igual a SPM_PAGESIZE"
+#endif
+
+/* Vetor "n": salta para o vetor "n" da imagem em execuo (bit 0 de
+ * GPIOR0 a 1 -> imagem B). Custa um sbis e um jmp na entrada de cada
+ * interrupo */
+#define TRAMPOLINE(n) \
+  void __vector_##n (void) __attribute__((naked, used, externally_visible)); \
+  void __vector_##n (void){ \
+    asm volatile ("sbis %0, 0\n\t" \
+                  "jmp %1\n\t" \
+                  "jmp %2" \
+                  :: "I" (_SFR_IO_ADDR(GPIOR0)), "i" (BOOT_SLOT_A + 4 * (n)), "i" (BOOT_SLOT_B + 4 * (n))); \
+  }
+
+TRAMPOLINE(1)  TRAMPOLINE(2)  TRAMPOLINE(3)  TRAMPOLINE(4)  TRAMPOLINE(5)
+TRAMPOLINE(6)  TRAMPOLINE(7)  TRAMPOLINE(8)  TRAMPOLINE(9)  TRAMPOLINE(10)
+TRAMPOLINE(11) TRAMPOLINE(12) TRAMPOLINE(13) TRAMPOLINE(14) TRAMPOLINE(15)
+TRAMPOLINE(16) TRAMPOLINE(17) TRAMPOLINE(18) TRAMPOLINE(19) TRAMPOLINE(20)
+TRAMPOLINE(21) TRAMPOLINE(22) TRAMPOLINE(23) TRAMPOLINE(24) TRAMPOLINE(25)
+
+/* Escreve uma pgina da flash, apenas no slot que no est em
+ * execuo (chamada pela firmware, por um ponteiro para
+ * BOOT_API_WRITE). Desliga as interrupes durante o apagamento e a
+ * escrita (cerca de 9ms), porque os vetores da imagem esto na parte
+ * da flash que fica inacessvel enquanto  escrita */
+void boot_write_page (uint16_t addr, const uint8_t *buf) __attribute__((section(".bootapi"), used, noinline));
+void boot_write_page (uint16_t addr, const uint8_t *buf){
+  uint16_t base = boot_slot_base(!(GPIOR0 & 1)); // Slot que no est em execuo
+  uint8_t sreg = SREG;
+  uint8_t i;
+
+  if ((addr & (BOOT_PAGE_SIZE - 1)) || (uint16_t)(addr - base) >= BOOT_SLOT_SIZE){ // Fora do slot livre (tambm se addr < base)
+    return;
+  }
+
+  cli();
+  eeprom_busy_wait(); // O SPM no pode comear com uma escrita da EEPROM em curso
+  boot_page_erase(addr);
+  boot_spm_busy_wait();
+  for (i = 0; i < BOOT_PAGE_SIZE; i += 2){ // Enche o buffer da pgina, palavra a palavra
+    boot_page_fill(addr + i, buf[i] | (buf[i + 1] << 8));
+  }
+  boot_page_write(addr);
+  boot_spm_busy_wait();
+  boot_rww_enable(); // Volta a permitir a leitura da parte da flash das imagens
+  SREG = sreg;
+}
+
+/* A imagem de um slot pode ser executada: no est apagada e, se o
+ * registo tem o seu tamanho, confere com o CRC guardado */
+static uint8_t slot_valid (const boot_record_t *rec, uint8_t slot){
+  uint16_t base = boot_slot_base(slot);
+  uint16_t size = rec->size[slot];
+  uint16_t crc = 0xFFFF;
+  uint16_t i;
+
+  if (0xFFFF == pgm_read_word(base) || 0 == size){ // Sem vetor de reset, ou marcada como vazia
+    return 0;
+  }
+  if (BOOT_SIZE_UNKNOWN == size){ // Gravada por ISP: no h como verificar
+    return 1;
+  }
+  for (i = 0; i < size; i++){
+    crc = _crc16_update(crc, pgm_read_byte(base + i));
+  }
+  return crc == rec->crc[slot];
+}
+
+int main (void){
+  boot_record_t rec;
+  uint8_t flags = MCUSR; // Causa do reset, passada  firmware em GPIOR1
+  uint8_t slot;
+
+  MCUSR = 0; // (o watchdog no desliga com WDRF ativo)
+  wdt_disable(); // Depois de um reset pelo watchdog continua ligado com o prazo mnimo
+
+  eeprom_read_block(&rec, (const void *)BOOT_RECORD_ADDR, sizeof(rec));
+  if (rec.check != boot_record_check(&rec) || rec.active > 1){ // Registo apagado ou corrompido
+    rec.active = 0;
+    rec.trial = BOOT_NONE;
+    rec.size[0] = rec.size[1] = BOOT_SIZE_UNKNOWN;
+  }
+
+  slot = rec.active;
+  if (rec.trial <= 1 && rec.trial != rec.active){ // H uma imagem nova por confirmar
+    if (rec.tries){
+      if (BOOT_TRIES == rec.tries){ // Primeiro arranque: o reset foi pedido pela firmware anterior
+        flags &= ~(1<<WDRF);
+        flags |= (1<<BOOT_FLAG_UPDATED);
+      }
+      rec.tries--;
+      slot = rec.trial;
+    }
+    else { // No se confirmou: volta  anterior
+      rec.trial = BOOT_NONE;
+      flags |= (1<<BOOT_FLAG_REVERTED);
+    }
+    rec.check = boot_record_check(&rec);
+    eeprom_update_block(&rec, (void *)BOOT_RECORD_ADDR, sizeof(rec));
+  }
+
+  if (!slot_valid(&rec, slot) && slot_valid(&rec, !slot)){ // A imagem escolhida est danificada
+    slot = !slot;
+    flags |= (1<<BOOT_FLAG_REVERTED);
+  }
+
+  GPIOR1 = flags;
+  GPIOR0 = slot; // Seleciona os vetores da imagem (ver TRAMPOLINE)
+  MCUCR = (1<<IVCE); // Interrupes pela tabela da seco de arranque
+  MCUCR = (1<<IVSEL);
+  ((void (*)(void))(boot_slot_base(slot) / 2))(); // Vetor de reset da imagem (endereo em palavras)
+  for (;;);
+}
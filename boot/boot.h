@@ -0,0 +1,86 @@
+/*
+ * boot.h
+ *  Mapa da memria e registo de arranque partilhados pelo bootloader
+ *  (boot/boot.c) e pela firmware (update.c)
+ *
+ *  A flash do ATmega328p  dividida em duas imagens da firmware (A e
+ *  B, BOOT_SLOT_SIZE bytes cada) e na seco de arranque (2KB no fim,
+ *  fusveis BOOTSZ = 1024 palavras e BOOTRST). Cada imagem  ligada
+ *  para o endereo do seu slot (make SLOT=A ou SLOT=B), pelo que
+ *  corre no stio onde foi escrita, sem cpias: o bootloader apenas
+ *  escolhe em qual entra. As interrupes passam pela tabela da
+ *  seco de arranque (IVSEL), que salta para a tabela da imagem em
+ *  execuo (bit 0 de GPIOR0), o que custa alguns ciclos por
+ *  interrupo.
+ *
+ *  Uma imagem nova  recebida pela firmware em execuo, por tramas
+ *  (ver update.h), e escrita no outro slot atravs de
+ *  boot_write_page(), em BOOT_API_WRITE (s a seco de arranque pode
+ *  escrever na flash). Depois de verificada, a firmware marca-a no
+ *  registo de arranque (em EEPROM) como "em experincia" e faz
+ *  reset: o bootloader entra na imagem nova no mximo BOOT_TRIES
+ *  vezes; se esta no se confirmar (update_poll(), ao fim de algum
+ *  tempo a correr) at l, por exemplo por ficar bloqueada e o
+ *  watchdog fazer reset, o bootloader volta  imagem anterior, que
+ *  ficou intacta no outro slot.
+ *
+ *  O bootloader passa a causa do reset (MCUSR, que tem de limpar
+ *  para desligar o watchdog) em GPIOR1, com os bits BOOT_FLAG_*.
+ *  Quem inclui este ficheiro tem de declarar antes
+ *  _crc8_ccitt_update() (util/crc16.h, ou hal.h).
+ */
+
+#ifndef BOOT_H_
+#define BOOT_H_
+
+#include <stdint.h>
+
+#define BOOT_START 0x7800 // Incio da seco de arranque (bytes, BOOTSZ = 1024 palavras)
+#define BOOT_SLOT_SIZE 0x3C00 // Tamanho mximo de uma imagem (15KB, verificado pelo Makefile: SLOT_SIZE)
+#define BOOT_SLOT_A 0x0000 // Endereo da imagem A
+#define BOOT_SLOT_B 0x3C00 // Endereo da imagem B
+#define BOOT_PAGE_SIZE 128 // Pgina da flash (SPM_PAGESIZE)
+#define BOOT_PAGES (BOOT_SLOT_SIZE / BOOT_PAGE_SIZE) // Pginas de uma imagem
+#define BOOT_API_WRITE 0x7F00 // Endereo (bytes) de boot_write_page() na seco de arranque
+
+#define BOOT_RECORD_ADDR 0x3F0 // Endereo do registo de arranque na EEPROM (fora das variveis EEMEM da firmware)
+#define BOOT_TRIES 3 // Arranques de uma imagem nova antes de voltar  anterior
+#define BOOT_NONE 0xFF // Nenhum slot
+#define BOOT_SIZE_UNKNOWN 0xFFFF // Imagem gravada por ISP (sem tamanho nem CRC conhecidos)
+
+#define BOOT_FLAG_UPDATED 6 // Bit de GPIOR1: primeiro arranque de uma imagem nova
+#define BOOT_FLAG_REVERTED 7 // Bit de GPIOR1: a imagem nova falhou e voltou-se  anterior
+
+#if BOOT_SLOT_B + BOOT_SLOT_SIZE > BOOT_START
+#error "As imagens no cabem antes da seco de arranque"
+#endif
+
+/* Registo de arranque (EEPROM apagada -> imagem A, sem experincia).
+ * Sem enchimento, para ter o mesmo formato na simulao */
+typedef struct __attribute__((packed)) {
+  uint8_t active; // Slot confirmado (0 A, 1 B)
+  uint8_t trial; // Slot da imagem nova em experincia (BOOT_NONE se nenhum)
+  uint8_t tries; // Arranques que restam  imagem em experincia
+  uint16_t size[2]; // Tamanho de cada imagem (0 vazia, BOOT_SIZE_UNKNOWN por ISP)
+  uint16_t crc[2]; // CRC-16 de cada imagem
+  uint8_t check; // CRC-8 dos bytes anteriores
+} boot_record_t;
+
+/* Endereo da imagem de um slot */
+static inline uint16_t boot_slot_base (uint8_t slot){
+  return slot ? BOOT_SLOT_B : BOOT_SLOT_A;
+}
+
+/* CRC-8 de um registo de arranque (campo check) */
+static inline uint8_t boot_record_check (const boot_record_t *rec){
+  const uint8_t *p = (const uint8_t *)rec;
+  uint8_t crc = 0xB0; // Valor inicial diferente de 0 para que zeros no sejam vlidos
+  uint8_t i;
+
+  for (i = 0; i < sizeof(*rec) - 1; i++){
+    crc = _crc8_ccitt_update(crc, p[i]);
+  }
+  return crc;
+}
+
+#endif /* BOOT_H_ */
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Firmware update of every blind controller on a serial line at once.
+
+Sends a firmware image (make SLOT=A image / make SLOT=B image) to all the
+nodes by broadcast, asks each node which pages it is missing, broadcasts
+those pages again until every node has the whole image, then commits it
+(see update.h). The time taken hardly depends on the number of nodes: the
+image goes out once, plus the pages some node lost.
+
+    fwupdate.py --port /dev/ttyUSB0 --nodes 1-12 --slot-b build/os-slotB/persiana.bin \\
+                --slot-a build/os-slotA/persiana.bin
+
+Nodes running from slot A take the slot B image and vice versa, so a mixed
+fleet needs both. Broadcasts get no reply on a shared RS-485 line, so
+FW_STATUS and FW_COMMIT always go to each node in turn.
+
+Requires pyserial.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+SOF = 0xA5
+SOF_REPLY = 0x5A
+BROADCAST = 0xFF
+RSP_ERR = 0xFF
+
+CMD_FW_BEGIN = 0x15
+CMD_FW_BLOCK = 0x16
+CMD_FW_STATUS = 0x17
+CMD_FW_COMMIT = 0x18
+
+ERR_NAMES = {1: "CRC", 2: "UNKNOWN", 3: "LENGTH", 4: "RANGE", 5: "BUSY", 6: "FULL", 7: "VERIFY"}
+
+BLOCK = 16            # UPDATE_BLOCK
+PAGE = 128            # BOOT_PAGE_SIZE
+SLOT_SIZE = 0x3C00    # BOOT_SLOT_SIZE
+STATUS_PAGES = 64     # UPDATE_STATUS_PAGES
+PAGE_TIME = 0.012     # UPDATE_PAGE_TIME: the node writes the page with interrupts off
+
+
+def crc8(data, crc=0):
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def crc16(data, crc=0xFFFF):
+    """_crc16_update() of avr-libc (polynomial 0xA001, reflected)."""
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+class Line:
+    def __init__(self, port, baud, timeout):
+        self.ser = serial.Serial(port, baud, timeout=timeout)
+        self.seq = 0
+
+    def send(self, addr, payload):
+        self.seq = (self.seq + 1) & 0xFF
+        body = bytes([addr, len(payload), self.seq]) + payload
+        self.ser.write(bytes([SOF]) + body + bytes([crc8(body)]))
+        return self.seq
+
+    def reply(self, seq):
+        """Payload of the reply with this sequence number, or None on timeout."""
+        deadline = time.monotonic() + self.ser.timeout
+        while time.monotonic() < deadline:
+            b = self.ser.read(1)
+            if not b or b[0] != SOF_REPLY:
+                continue
+            head = self.ser.read(3)
+            if len(head) < 3:
+                return None
+            rest = self.ser.read(head[1] + 1)
+            if len(rest) < head[1] + 1 or crc8(head + rest[:-1]) != rest[-1]:
+                continue
+            if head[2] == seq:
+                return rest[:-1]
+        return None
+
+    def command(self, addr, payload, retries=3):
+        for _ in range(retries):
+            r = self.reply(self.send(addr, payload))
+            if r is not None:
+                return r
+        return None
+
+
+def error(r):
+    """Error code at the end of a reply, 0 if none."""
+    return r[-1] if r and len(r) >= 2 and r[-2] == RSP_ERR else 0
+
+
+def missing_pages(line, node, pages):
+    """(running slot, set of missing pages) of one node, or None if it doesn't answer."""
+    missing = set()
+    slot = None
+    for first in range(0, pages, STATUS_PAGES):
+        r = line.command(node, bytes([CMD_FW_STATUS, first]))
+        if r is None or error(r) or len(r) != 12:
+            return None
+        slot = r[1]
+        for i, bits in enumerate(r[4:]):
+            missing.update(first + i * 8 + j for j in range(8) if bits >> j & 1)
+    return slot, missing
+
+
+def send_pages(line, image, pages):
+    for page in sorted(pages):
+        for index in range(page * PAGE // BLOCK, min((page + 1) * PAGE, len(image)) // BLOCK):
+            data = image[index * BLOCK:(index + 1) * BLOCK]
+            line.send(BROADCAST, struct.pack("<BHH", CMD_FW_BLOCK, index, crc16(data)) + data)
+            line.ser.flush()
+        time.sleep(PAGE_TIME)
+
+
+def update(line, nodes, slot, image, rounds):
+    """Sends one image to the nodes not running its slot; returns the nodes that committed it."""
+    image += b"\xff" * (-len(image) % BLOCK)  # whole blocks (the node pads the last page with 0xFF)
+    size = len(image)
+    pages = (size + PAGE - 1) // PAGE
+    name = "AB"[slot]
+    print("slot %s: %d bytes, %d pages, CRC %04X" % (name, size, pages, crc16(image)))
+
+    line.send(BROADCAST, struct.pack("<BBHH", CMD_FW_BEGIN, slot, size, crc16(image)))
+    time.sleep(0.1)  # the nodes clear the session in EEPROM
+    line.ser.reset_input_buffer()
+    todo = set(range(pages))
+    targets = set(nodes)
+    for n in range(rounds):
+        send_pages(line, image, todo)
+        line.ser.reset_input_buffer()
+        todo = set()
+        for node in sorted(targets):
+            status = missing_pages(line, node, pages)
+            if status is None:
+                print("  node %d: no answer" % node)
+                continue
+            if status[0] == slot:  # runs this slot: takes the other image
+                targets.discard(node)
+                continue
+            todo |= status[1]
+        print("  round %d: %d nodes, %d pages missing" % (n + 1, len(targets), len(todo)))
+        if not todo:
+            break
+        line.send(BROADCAST, struct.pack("<BBHH", CMD_FW_BEGIN, slot, size, crc16(image)))  # resumes
+        time.sleep(0.05)
+    else:
+        print("  giving up with pages missing")
+        return set()
+
+    done = set()
+    for node in sorted(targets):
+        r = line.command(node, bytes([CMD_FW_COMMIT]))
+        err = error(r) if r is not None else None
+        print("  node %d: %s" % (node, "committed" if err == 0 else "no answer" if err is None else "ERR_" + ERR_NAMES.get(err, str(err))))
+        if err == 0:
+            done.add(node)
+    return done
+
+
+def node_list(text):
+    nodes = []
+    for part in text.split(","):
+        a, _, b = part.partition("-")
+        nodes.extend(range(int(a, 0), int(b or a, 0) + 1))
+    return nodes
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    p.add_argument("--port", required=True)
+    p.add_argument("--baud", type=int, default=57600)
+    p.add_argument("--nodes", type=node_list, required=True, help="addresses, e.g. 1-12,20")
+    p.add_argument("--slot-a", type=argparse.FileType("rb"), help="image linked for slot A")
+    p.add_argument("--slot-b", type=argparse.FileType("rb"), help="image linked for slot B")
+    p.add_argument("--rounds", type=int, default=5, help="re-request rounds before giving up")
+    p.add_argument("--timeout", type=float, default=0.2, help="reply timeout (s)")
+    args = p.parse_args()
+
+    line = Line(args.port, args.baud, args.timeout)
+    done = set()
+    for slot, f in ((1, args.slot_b), (0, args.slot_a)):
+        if f:
+            image = f.read()
+            if not image or len(image) > SLOT_SIZE:
+                sys.exit("%s: image size must be 1..%d bytes" % (f.name, SLOT_SIZE))
+            # (a node updated by the first image is now running it, unconfirmed, and refuses the second)
+            done |= update(line, sorted(set(args.nodes) - done), slot, image, args.rounds)
+    missing = sorted(set(args.nodes) - done)
+    if missing:
+        print("not updated: %s" % ", ".join(map(str, missing)))
+    sys.exit(1 if missing else 0)
+
+
+if __name__ == "__main__":
+    main()
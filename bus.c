@@ -0,0 +1,70 @@
+/*
+ * bus.c
+ *  Endereamento para vrias persianas na mesma linha srie
+ *
+ *  O endereo e a mscara de grupos so lidos da EEPROM no arranque
+ *  e mantidos em RAM, para que a ISR de receo os possa consultar
+ *  sem esperar pela EEPROM. Uma EEPROM apagada (0xFF) corresponde a
+ *  um n no configurado: endereo BUS_ADDR_DEFAULT, nenhum grupo e
+ *  janela derivada do endereo.
+ */
+
+#include "hal.h"
+#include "bus.h"
+
+static uint8_t EEMEM ee_bus_addr = BUS_ADDR_DEFAULT; // Endereo guardado em EEPROM
+static uint16_t EEMEM ee_bus_groups = 0; // Mscara de grupos guardada em EEPROM
+static uint8_t EEMEM ee_bus_slot = BUS_SLOT_AUTO; // Janela guardada em EEPROM
+
+uint8_t bus_addr = BUS_ADDR_DEFAULT;
+uint16_t bus_groups = 0;
+uint8_t bus_slot = 0;
+uint8_t bus_slot_set = 0;
+volatile uint8_t bus_selected = 0;
+
+/* Escolhe a janela: a configurada ou, se no houver, a derivada do endereo */
+static void apply_slot (uint8_t slot){
+  bus_slot_set = (slot <= BUS_SLOT_MAX);
+  bus_slot = bus_slot_set ? slot : (bus_addr - 1) % BUS_SLOTS_AUTO;
+}
+
+/* L a configurao do endereo da EEPROM */
+void bus_init (void){
+  uint8_t addr = eeprom_read_byte(&ee_bus_addr);
+  uint16_t groups = eeprom_read_word(&ee_bus_groups);
+
+  bus_addr = (addr && addr <= BUS_ADDR_MAX) ? addr : BUS_ADDR_DEFAULT;
+  bus_groups = (0xFFFF == groups) ? 0 : (groups & 0x7FFF); // S existem 15 grupos
+  apply_slot(eeprom_read_byte(&ee_bus_slot));
+}
+
+/* Altera (e guarda em EEPROM) o endereo e os grupos deste n.
+ * Devolve 0 se o endereo no for um endereo individual vlido */
+uint8_t bus_configure (uint8_t addr, uint16_t groups){
+  if (!addr || addr > BUS_ADDR_MAX){
+    return 0;
+  }
+
+  groups &= 0x7FFF;
+  eeprom_update_byte(&ee_bus_addr, addr);
+  eeprom_update_word(&ee_bus_groups, groups);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // A ISR de receo no pode ver a configurao a meio
+    bus_addr = addr;
+    bus_groups = groups;
+  }
+  if (!bus_slot_set){ // A janela derivada acompanha o endereo
+    apply_slot(BUS_SLOT_AUTO);
+  }
+  return 1;
+}
+
+/* Altera (e guarda em EEPROM) a janela deste n; BUS_SLOT_AUTO volta
+ * a deriv-la do endereo. Devolve 0 se estiver fora dos limites */
+uint8_t bus_configure_slot (uint8_t slot){
+  if (slot > BUS_SLOT_MAX && BUS_SLOT_AUTO != slot){
+    return 0;
+  }
+  eeprom_update_byte(&ee_bus_slot, slot);
+  apply_slot(slot);
+  return 1;
+}
@@ -0,0 +1,100 @@
+/*
+ * bus.h
+ *  Endereamento para vrias persianas na mesma linha srie
+ *
+ *  Modos de ligao (BUS_MODE, escolhido na compilao):
+ *   BUS_P2P   - ligao ponto-a-ponto (USB), como originalmente. Todos
+ *               os bytes recebidos so para este n e h eco.
+ *   BUS_RS485 - linha RS-485 partilhada (half-duplex) com 8 bits de
+ *               dados. S so aceites tramas cujo endereo corresponda
+ *               a este n (filtragem por software), sem eco.
+ *   BUS_MPCM  - linha RS-485 partilhada com 9 bits de dados e o modo
+ *               multiprocessador do ATMega328p (MPCM). O computador
+ *               envia um caracter de endereo (9 bit a 1) e s os ns
+ *               a que se destina passam a receber os bytes seguintes;
+ *               os restantes filtram-nos no hardware, sem interrupes.
+ *               Os comandos de um s caracter voltam a ser aceites
+ *               (pelo n selecionado). Sem eco.
+ *  Nos modos RS-485 o pino BUS_DE (driver enable)  ativado antes de
+ *  transmitir e desativado quando o ltimo bit sai da linha.
+ *
+ *  Endereos:
+ *   0x01~0xEF - endereo individual de um n (guardado em EEPROM)
+ *   0xF0~0xFE - grupo 0~14 (cada n pode pertencer a vrios grupos,
+ *               conforme a mscara de grupos guardada em EEPROM)
+ *   0xFF      - todos os ns (difuso)
+ *  Tramas para um grupo ou para todos no tm resposta nos modos
+ *  RS-485, para que os ns no transmitam ao mesmo tempo, exceto nos
+ *  ns com uma janela configurada (ver abaixo).
+ *
+ *  Janelas (arranque escalonado):
+ *   Cada n tem uma janela 0~BUS_SLOT_MAX, de BUS_SLOT_TIME ms. Um
+ *   movimento pedido a um grupo ou a todos (trama, comando de um s
+ *   caracter depois de um endereo de grupo em BUS_MPCM, cena ou
+ *   horrio) s liga o motor bus_offset() ms depois, para que os
+ *   motores de um grupo no arranquem todos no mesmo ms (a soma das
+ *   correntes de arranque dispararia o disjuntor). Se a janela no
+ *   for configurada (CMD_SET_SLOT)  derivada do endereo, entre 0 e
+ *   BUS_SLOTS_AUTO-1; ns com endereos seguidos arrancam em
+ *   janelas seguidas. S com uma janela configurada (nica no grupo,
+ *   escolhida pelo instalador)  que o n responde s tramas para um
+ *   grupo ou para todos, no incio da sua janela, depois de receber
+ *   a trama; com janelas derivadas do endereo dois ns podiam
+ *   responder ao mesmo tempo.
+ */
+
+#ifndef BUS_H_
+#define BUS_H_
+
+#include <stdint.h>
+
+#define BUS_P2P 0 // Ponto-a-ponto
+#define BUS_RS485 1 // RS-485, 8 bits, filtragem por software
+#define BUS_MPCM 2 // RS-485, 9 bits, filtragem por hardware (MPCM)
+
+#ifndef BUS_MODE
+#define BUS_MODE BUS_P2P
+#endif
+
+#define BUS_ADDR_DEFAULT 0x01 // Endereo usado enquanto a EEPROM no estiver configurada
+#define BUS_ADDR_MAX 0xEF // ltimo endereo individual
+#define BUS_GROUP_FIRST 0xF0 // Endereo do grupo 0
+#define BUS_BROADCAST 0xFF // Endereo de difuso
+
+#define BUS_SLOT_TIME 50 // Durao de uma janela (ms): cobre a corrente de arranque e uma resposta completa a 9600 bps
+#define BUS_SLOT_MAX 63 // ltima janela configurvel
+#define BUS_SLOTS_AUTO 16 // Janelas usadas quando so derivadas do endereo
+#define BUS_SLOT_AUTO 0xFF // Janela derivada do endereo (EEPROM apagada)
+
+extern uint8_t bus_addr; // Endereo deste n
+extern uint16_t bus_groups; // Mscara de grupos a que este n pertence
+extern uint8_t bus_slot; // Janela deste n
+extern uint8_t bus_slot_set; // A janela foi configurada (no derivada do endereo)
+extern volatile uint8_t bus_selected; // ltimo endereo que selecionou este n (BUS_MPCM, escrito pela ISR de receo)
+
+void bus_init(void);
+uint8_t bus_configure(uint8_t addr, uint16_t groups);
+uint8_t bus_configure_slot(uint8_t slot);
+
+/* Atraso (ms) dos arranques e respostas pedidos a um grupo ou a todos */
+static inline uint16_t bus_offset (void){
+  return bus_slot * BUS_SLOT_TIME;
+}
+
+/* Verifica se um endereo se destina a este n (usado tambm na ISR de receo) */
+static inline uint8_t bus_match (uint8_t addr){
+  if (BUS_BROADCAST == addr || bus_addr == addr){
+    return 1;
+  }
+  if (addr >= BUS_GROUP_FIRST){
+    return (bus_groups >> (addr - BUS_GROUP_FIRST)) & 1;
+  }
+  return 0;
+}
+
+/* Verifica se um endereo  partilhado por vrios ns (grupo ou difuso) */
+static inline uint8_t bus_is_multicast (uint8_t addr){
+  return addr >= BUS_GROUP_FIRST;
+}
+
+#endif /* BUS_H_ */
@@ -0,0 +1,23 @@
+/*
+ * buttons.c
+ *  Leitura dos botes com filtragem de ressaltos (debounce) feita na
+ *  interrupo do timer 2 (ver buttons.h)
+ */
+
+#include "buttons.h"
+
+volatile uint8_t btn_state = 0;
+volatile uint8_t btn_press = 0;
+uint8_t btn_ct0 = 0xFF; // Contadores comeam em 3 (nenhuma mudana pendente)
+uint8_t btn_ct1 = 0xFF;
+uint8_t btn_div = BTN_SAMPLE_MS;
+
+/* Devolve o estado filtrado dos botes e os que foram premidos desde a
+ * ltima chamada (mscaras com os bits CLOSE e OPEN) */
+void buttons_read (uint8_t *state, uint8_t *pressed){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // L e limpa as transies sem perder uma que chegue entretanto
+    *state = btn_state;
+    *pressed = btn_press;
+    btn_press = 0;
+  }
+}
@@ -0,0 +1,53 @@
+/*
+ * buttons.h
+ *  Leitura dos botes com filtragem de ressaltos (debounce) feita na
+ *  interrupo do timer 2
+ *
+ *  Os botes so amostrados a cada BTN_SAMPLE_MS ms por contadores
+ *  verticais: cada bit dos bytes btn_ct0/btn_ct1  um contador de 2
+ *  bits de um pino, pelo que todos os botes so filtrados ao mesmo
+ *  tempo com meia dzia de operaes lgicas. Um boto s muda de
+ *  estado depois de 4 amostras consecutivas diferentes do estado
+ *  atual (entre 6 e 8ms), e qualquer ressalto recomea a contagem.
+ *  O estado filtrado  publicado em btn_state e as transies para
+ *  premido so acumuladas em btn_press at o main() as consumir, para
+ *  que um clique nunca se perca nem conte duas vezes, seja qual for a
+ *  velocidade do ciclo principal.
+ */
+
+#ifndef BUTTONS_H_
+#define BUTTONS_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+#define BTN_MASK ((1<<CLOSE) | (1<<OPEN)) // Bits dos botes (pinos CLOSE e OPEN, ver hal_avr.h)
+
+#define BTN_SAMPLE_MS 2 // Perodo de amostragem dos botes (ms)
+
+extern volatile uint8_t btn_state; // Estado filtrado dos botes (bit a 1 -> premido)
+extern volatile uint8_t btn_press; // Botes que foram premidos desde a ltima leitura
+extern uint8_t btn_ct0; // Bit menos significativo dos contadores verticais
+extern uint8_t btn_ct1; // Bit mais significativo dos contadores verticais
+extern uint8_t btn_div; // Divisor do ms para o perodo de amostragem
+
+void buttons_read(uint8_t *state, uint8_t *pressed);
+
+/* Amostra e filtra os botes (s deve ser chamada pela ISR do timer 2, a cada ms) */
+static inline void buttons_tick (void){
+  uint8_t changed;
+
+  if (--btn_div){
+    return;
+  }
+  btn_div = BTN_SAMPLE_MS;
+
+  changed = btn_state ^ hal_buttons(); // Pinos cujo valor lido difere do estado filtrado
+  btn_ct0 = ~(btn_ct0 & changed); // Conta (ou recomea em 3, se no mudou)
+  btn_ct1 = btn_ct0 ^ (btn_ct1 & changed);
+  changed &= btn_ct0 & btn_ct1; // Contadores que deram a volta: 4 amostras seguidas diferentes
+  btn_state ^= changed; // Muda o estado filtrado
+  btn_press |= btn_state & changed; // Regista as transies para premido
+}
+
+#endif /* BUTTONS_H_ */
@@ -0,0 +1,52 @@
+/*
+ * clock.c
+ *  Base de tempo de 1ms (timer 2 em modo CTC) e relgio monotnico
+ *  de 32 bits partilhado por todo o programa
+ *
+ *  O timer 2 conta em modo CTC (Clear Timer on Compare): o contador
+ *  volta a 0 no hardware quando atinge OCR2A, gerando a interrupo
+ *  TIMER2_COMPA_vect. Ao contrrio de recarregar TCNT2 na ISR, o
+ *  perodo no depende do atraso com que a ISR  atendida, pelo que
+ *  no h deriva nem jitter acumulado.
+ *   Fcpu / (TP * (OCR2A+1)) = 16M / (128 * 125) = 1kHz
+ *  O timer 2 tem uma tabela de prescalers diferente dos timers 0 e
+ *  1: CS22:0 = 101 corresponde a /128 (nos outros seria /1024).
+ *
+ *  clock_ms d a volta a cada 49.7 dias; as comparaes de tempo
+ *  devem ser feitas pela diferena ((uint32_t)(agora - antes)).
+ */
+
+#include "hal.h"
+#include "clock.h"
+
+volatile uint32_t clock_ms = 0;
+
+/* Configura timer 2 para gerar uma interrupo a cada 1ms */
+void config_timer2 (void){
+  hal_timer_init(T2TOP); // 125 contagens por perodo (0~124)
+}
+
+/* Devolve os ms desde o arranque */
+uint32_t millis (void){
+  uint32_t ms;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // Leitura de 32 bits no pode ser interrompida pela ISR
+    ms = clock_ms;
+  }
+  return ms;
+}
+
+/* L o instante atual: ms desde o arranque e frao do ms atual
+ * em contagens do timer 2 (0~124, 8us cada) */
+void timestamp (uint32_t *ms, uint8_t *sub){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    uint8_t count = hal_timer_count();
+    uint32_t ticks = clock_ms;
+
+    if (hal_timer_pending() && count < (T2TOP/2)){ // Comparao ainda no atendida pela ISR
+      ticks++; // o ms j terminou, o contador recomeou em 0
+    }
+    *ms = ticks;
+    *sub = count;
+  }
+}
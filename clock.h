@@ -0,0 +1,25 @@
+/*
+ * clock.h
+ *  Base de tempo de 1ms (timer 2 em modo CTC) e relgio monotnico
+ *  de 32 bits partilhado por todo o programa
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+
+#define T2TOP 124 // Valor mximo de contagem do timer 2: 125 contagens (0~124) por ms
+
+extern volatile uint32_t clock_ms; // ms desde o arranque, incrementado pela ISR do timer 2
+
+void config_timer2(void);
+uint32_t millis(void);
+void timestamp(uint32_t *ms, uint8_t *sub);
+
+/* Avana o relgio (s deve ser chamada pela ISR do timer 2) */
+static inline void clock_tick (void){
+  clock_ms++;
+}
+
+#endif /* CLOCK_H_ */
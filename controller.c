@@ -0,0 +1,763 @@
+/*
+ * controller.c
+ *  Lgica de controlo da persiana, independente do hardware (ver
+ *  controller.h e a descrio do programa em main.c)
+ */
+
+#include "hal.h"
+#include "controller.h"
+#include "protocol.h"
+#include "telemetry.h"
+#include "endstop.h"
+#include "baud.h"
+#include "schedule.h"
+#include "update.h"
+#include "params.h"
+
+// DEBUG mode
+//#define DEBUG
+
+#define OUT_KEEP 0xFF // Sadas decididas pela ao de entrada do estado, em vez das OUT_* (motor.h)
+
+#ifndef OPEN_X_DEADBAND
+#define OPEN_X_DEADBAND 50 // Erro aceite na altura de referncia (~0.4% do percurso): mais perto do que isto a persiana no se move
+#endif
+#define CAL_PAUSE 500 // 0.5s de motor parado entre fases da calibrao (evita inverter o motor ligado)
+#define CAL_TIMEOUT ((uint32_t)POS_TRAVEL_MAX+POS_KICK_MAX) // Tempo mximo de cada fase da calibrao
+
+// Fases da calibrao
+#define CAL_SEEK 0 // Fecha at ao fim de curso inferior (posio de partida)
+#define CAL_WAIT_UP 1 // Pausa antes de abrir
+#define CAL_UP 2 // Abre at ao fim de curso superior, cronometrando
+#define CAL_WAIT_DOWN 3 // Pausa antes de fechar
+#define CAL_DOWN 4 // Fecha at ao fim de curso inferior, cronometrando
+
+// Resultado da ltima calibrao
+#define CAL_NONE 0 // Nunca foi feita desde o arranque
+#define CAL_RUNNING 1 // Em curso
+#define CAL_OK 2 // Concluda e guardada em EEPROM
+#define CAL_FAILED 3 // Cancelada, sem fim de curso dentro do tempo mximo ou com tempos fora dos limites
+
+uint8_t OpenBtn = 0; // Varivel auxiliar de verificao (Boto de abertura pressionado -> 1)
+uint8_t CloseBtn = 0; // Varivel auxiliar de verificao (Boto de fecho pressionado -> 1)
+uint8_t RE_OpenBtn = 0; // Rising Edge de OpenBtn
+uint8_t RE_CloseBtn = 0; // Rising Edge de CloseBtn
+uint8_t USB_input = 0; // ltimo caracter recebido por porta srie que foi processado
+volatile uint8_t rx_buf[RX_BUF_SIZE];
+volatile uint8_t rx_head = 0;
+volatile uint8_t rx_tail = 0;
+volatile uint16_t rx_overflow = 0;
+volatile uint8_t rx_idle_ms = 0;
+uint8_t state = INIT;
+uint16_t height_reference = 0;
+uint8_t cal_phase = CAL_SEEK; // Fase atual da calibrao (apenas pertinente no estado CALIBRATE)
+uint8_t cal_result = CAL_NONE; // Resultado da ltima calibrao
+uint32_t cal_start = 0; // Instante de incio da fase atual da calibrao
+uint16_t cal_up = 0; // Tempo de subida medido na calibrao
+uint8_t x_dir = OUT_OFF; // Sentido do movimento no estado OPEN_X (OUT_OFF se j estava na altura de referncia)
+uint8_t rehomes = 0; // Reinicializaes seguidas depois de falhas (ver supervisor.h)
+#ifdef DEBUG
+uint8_t printfstate = 254; // ltimo estado impresso (apenas pertinente no caso de debug)
+#endif
+
+typedef uint8_t (*predicate_t)(void); // Condio de uma transio
+typedef void (*action_t)(void); // Ao de entrada/sada de um estado
+
+typedef struct {
+  predicate_t when; // Condio (avaliada a cada passagem)
+  uint8_t next; // Estado seguinte, se a condio for verdadeira
+} transition_t;
+
+typedef struct {
+  uint8_t outputs; // Sadas do motor no estado (OUT_*)
+  action_t enter; // Executada ao entrar no estado (ou NULL)
+  action_t exit; // Executada ao sair do estado (ou NULL)
+  action_t run; // Executada nas passagens sem transio (ou NULL)
+  const transition_t *transitions; // Transies, por ordem de prioridade (em memria de programa)
+  uint8_t count; // Nmero de transies
+} state_desc_t;
+
+void goto_state(uint8_t next);
+uint8_t io_flags(void);
+uint16_t run_limit(uint8_t next);
+
+
+/* Devolve o nmero de caracteres perdidos por o buffer de receo estar cheio */
+uint16_t rx_overflows (void){
+  uint16_t count;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // Leitura de 16 bits no pode ser interrompida pela ISR
+    count = rx_overflow;
+  }
+  return count;
+}
+
+/* Arranque escalonado: um movimento pedido a um grupo ou a todos s
+ * liga o motor na janela deste n (ver bus.h); os restantes arrancam
+ * logo. Chamada antes de mudar de estado */
+void stagger (uint8_t multicast){
+  motor_stagger(multicast ? bus_offset() : 0);
+}
+
+/* Fora a mquina de estados a responder ao caracter recebido por porta srie */
+void process_input (uint8_t input){
+  uint8_t multicast = BUS_MODE == BUS_MPCM && bus_is_multicast(bus_selected); // (s em BUS_MPCM um caracter pode ter sido enviado a um grupo)
+
+  if (INIT==state){ // Comandos so ignorados durante a inicializao
+    return;
+  }
+
+  if ('u' == input){ // Se se premiu "u", abre completamente
+    stagger(multicast); // (s os caracteres que movem a persiana mudam a janela de um arranque pendente)
+    goto_state(OPEN_AUTO); // Abre (completamente) em modo automtico
+  }
+  else if ('0' == input) { // Se se premiu "0", fecha completamente
+    stagger(multicast);
+    goto_state(CLOSE_AUTO); // Fecha (completamente) em modo automtico
+  }
+  else if (input>'0' && input<='9'){ // Foi premido um nmero que no zero
+    height_reference = param_open_10*(input-48)+param[PARAM_OPEN_TIME]; // Toma valores desde 10% a 90% de abertura, dependendo da tecla premida
+    stagger(multicast);
+    goto_state(OPEN_X); // Abre/fecha at height_reference
+  }
+  else if (input == 'g'){ // Se se premiu "g", separa as tbuas sem abrir a persiana
+    height_reference = param[PARAM_OPEN_TIME]; // Altura de abertura efetiva da persiana
+    stagger(multicast);
+    goto_state(OPEN_X); // Abre/fecha at ficar com as tbuas separadas
+  }
+}
+
+/* Movimento pedido pelo horrio ou por uma cena (ver schedule.h):
+ * abre/fecha at "h", como CMD_GOTO_MS, exceto durante a
+ * inicializao e a calibrao, que no so interrompidas */
+void goto_scheduled (uint16_t h){
+  if (INIT == state || CALIBRATE == state){
+    return;
+  }
+  stagger(1); // (o horrio e as cenas chegam a vrios ns ao mesmo tempo)
+  height_reference = h;
+  goto_state(OPEN_X);
+}
+
+/* Executa um comando recebido numa trama (ver protocol.h) */
+uint8_t protocol_execute (uint8_t cmd, const uint8_t *arg){
+  uint16_t value;
+
+  baud_confirm(); // Uma trama vlida confirma a velocidade atual da porta srie
+
+  if (CMD_QUERY == cmd){ // A consulta  sempre permitida
+    protocol_reply_u8(state);
+    protocol_reply_u16(position_height());
+    protocol_reply_u16(height_reference);
+    return 0;
+  }
+
+  if (CMD_STATUS == cmd){ // Estado completo, copiado diretamente para a resposta (sempre permitido)
+    proto_status_t *status = protocol_reply_reserve(sizeof(*status));
+
+    if (!status){
+      return ERR_FULL;
+    }
+    status->state = state;
+    status->io = io_flags();
+    status->height = position_height();
+    status->height_reference = height_reference;
+    status->uptime = millis();
+    status->rx_overflow = rx_overflows();
+    status->tx_dropped = usart_tx_dropped();
+    status->crc_errors = proto_crc_errors;
+    status->version = FIRMWARE_VERSION;
+    return 0;
+  }
+
+  if (CMD_SET_ADDR == cmd){ // Configurao do endereo (tambm permitida durante a inicializao)
+    return bus_configure(arg[0], arg[1] | (arg[2] << 8)) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_GET_MODEL == cmd){ // Consulta dos parmetros do modelo de posio
+    protocol_reply_u16(pos_params.travel_up);
+    protocol_reply_u16(pos_params.travel_down);
+    protocol_reply_u16(pos_params.kick_up);
+    protocol_reply_u16(pos_params.kick_down);
+    protocol_reply_u16(pos_params.coast);
+    protocol_reply_u8(cal_result);
+    return 0;
+  }
+
+  if (CMD_SET_MODEL == cmd){ // Altera os parmetros do modelo de posio (a altura atual mantm-se)
+    position_params_t params;
+
+    params.travel_up = arg[0] | (arg[1] << 8);
+    params.travel_down = arg[2] | (arg[3] << 8);
+    params.kick_up = arg[4] | (arg[5] << 8);
+    params.kick_down = arg[6] | (arg[7] << 8);
+    params.coast = arg[8] | (arg[9] << 8);
+    return position_configure(&params) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_SET_BAUD == cmd){ // Muda a velocidade da porta srie (tambm permitida durante a inicializao)
+    return baud_request(arg[0] | (arg[1] << 8)) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_TELEMETRY == cmd){ // Configurao da telemetria (tambm permitida durante a inicializao)
+    return telemetry_configure(arg[0] | (arg[1] << 8), arg[2]) ? 0 : ERR_BUSY;
+  }
+
+  if (CMD_SET_TIME == cmd){ // Acerta a hora do horrio (tambm permitido durante a inicializao)
+    return schedule_set_time(arg[0] | (arg[1] << 8) | ((uint32_t)arg[2] << 16) | ((uint32_t)arg[3] << 24)) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_GET_TIME == cmd){ // Consulta da hora do horrio
+    uint32_t ms = schedule_time();
+
+    protocol_reply_u16(ms & 0xFFFF);
+    protocol_reply_u16(ms >> 16);
+    return 0;
+  }
+
+  if (CMD_GET_FAULT == cmd){ // Consulta do registo de falhas (0  a mais recente)
+    sup_fault_t fault = {FAULT_NONE, 0, 0, 0, 0}; // (registo vazio)
+
+    if (arg[0] >= SUP_LOG){
+      return ERR_RANGE;
+    }
+    supervisor_fault(arg[0], &fault);
+    protocol_reply_u8(fault.code);
+    protocol_reply_u8(fault.state);
+    protocol_reply_u16(fault.height);
+    protocol_reply_u16(fault.uptime & 0xFFFF);
+    protocol_reply_u16(fault.uptime >> 16);
+    protocol_reply_u8(fault.repeats);
+    return 0;
+  }
+
+  if (CMD_GET_PARAM == cmd){ // Consulta de um parmetro, com os limites e o valor original
+    param_desc_t desc;
+
+    if (arg[0] >= PARAMS){
+      return ERR_RANGE;
+    }
+    param_limits(arg[0], &desc);
+    protocol_reply_u16(param[arg[0]]);
+    protocol_reply_u16(desc.min);
+    protocol_reply_u16(desc.max);
+    protocol_reply_u16(desc.value);
+    return 0;
+  }
+
+  if (CMD_SET_PARAM == cmd){ // Altera um parmetro (tambm permitido durante a inicializao)
+    return param_set(arg[0], arg[1] | (arg[2] << 8)) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_GET_CURRENT == cmd){ // Consulta da corrente do motor (para ajustar CUR_STALL_LEVEL)
+    protocol_reply_u16(current_level());
+    protocol_reply_u8(cur_end);
+    return 0;
+  }
+
+  if (CMD_SET_SLOT == cmd){ // Altera a janela deste n (tambm permitido durante a inicializao)
+    return bus_configure_slot(arg[0]) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_SET_SCHEDULE == cmd){ // Altera uma entrada do horrio
+    return schedule_set(arg[0], arg[1] | (arg[2] << 8), arg[3] | (arg[4] << 8), arg[5]) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_SET_SCENE == cmd){ // Altera a altura deste n numa cena
+    return scene_set(arg[0], arg[1] | (arg[2] << 8)) ? 0 : ERR_RANGE;
+  }
+
+  if (CMD_FW_STATUS == cmd){ // Pginas em falta da imagem nova (sempre permitido)
+    return update_status(arg[0]);
+  }
+
+  if (CMD_FW_BEGIN == cmd || CMD_FW_BLOCK == cmd || CMD_FW_COMMIT == cmd){ // Atualizao da firmware: s com a persiana parada
+    if (IDLE != state || motor_on() || position_moving()){ // (a escrita da flash atrasa a ISR do timer 2)
+      return ERR_BUSY;
+    }
+    if (CMD_FW_BEGIN == cmd){
+      return update_begin(arg[0], arg[1] | (arg[2] << 8), arg[3] | (arg[4] << 8));
+    }
+    if (CMD_FW_BLOCK == cmd){
+      return update_block(arg[0] | (arg[1] << 8), arg[2] | (arg[3] << 8), &arg[4]);
+    }
+    return update_commit();
+  }
+
+  if (INIT == state){ // Comandos de movimento so ignorados durante a inicializao
+    return ERR_BUSY;
+  }
+
+  stagger(proto_multicast); // Uma trama para um grupo ou para todos arranca na janela deste n
+
+  switch (cmd){
+    case CMD_STOP: // Para a persiana
+      goto_state(IDLE);
+      break;
+
+    case CMD_OPEN: // Abre completamente
+      goto_state(OPEN_AUTO);
+      break;
+
+    case CMD_CLOSE: // Fecha completamente
+      goto_state(CLOSE_AUTO);
+      break;
+
+    case CMD_CALIBRATE: // Mede os tempos de percurso entre os fins de curso
+      if (!END_DETECT){ // Sem fins de curso (nem medio de corrente) no h como medir
+        return ERR_BUSY;
+      }
+      goto_state(CALIBRATE);
+      break;
+
+    case CMD_SCENE: // Vai para a altura deste n numa cena (normalmente por difuso)
+      if (arg[0] >= SCENES){
+        return ERR_RANGE;
+      }
+      value = scene_height(arg[0]);
+      if (SCENE_NONE != value){ // (se este n participa nela)
+        height_reference = value;
+        goto_state(OPEN_X);
+      }
+      break;
+
+    case CMD_GOTO_MS: // Abre/fecha at uma altura absoluta (em ms de subida)
+      value = arg[0] | (arg[1] << 8);
+      if (value > MAX_HEIGHT){
+        return ERR_RANGE;
+      }
+      height_reference = value;
+      goto_state(OPEN_X);
+      break;
+
+    case CMD_GOTO_PERMILLE: // Abre/fecha at uma abertura em dcimas de %
+      value = arg[0] | (arg[1] << 8);
+      if (value > 1000){
+        return ERR_RANGE;
+      }
+      if (!value){ // 0% corresponde a fechar (como '0')
+        goto_state(CLOSE_AUTO);
+      }
+      else if (1000 == value){ // 100% corresponde a abrir completamente (como 'u')
+        goto_state(OPEN_AUTO);
+      }
+      else { // Mesma relao que os comandos '1'~'9', com 10 vezes mais resoluo
+        height_reference = (uint32_t)param_open_10*value/100+param[PARAM_OPEN_TIME];
+        goto_state(OPEN_X);
+      }
+      break;
+  }
+  return 0;
+}
+
+/* Uma fase da calibrao: a fase CAL_SEEK fecha a persiana at ao
+ * fim de curso inferior; seguem-se a subida e a descida completas,
+ * cronometradas, com uma pausa de motor desligado antes de cada
+ * mudana de direo. Ao chegar de novo  base os tempos medidos
+ * (descontando os atrasos de arranque) passam a ser os do modelo */
+void calibrate (void){
+  uint32_t elapsed = millis() - cal_start;
+  position_params_t params;
+
+  switch (cal_phase){
+    case CAL_SEEK:
+    case CAL_DOWN:
+      if (endstop_bottom()){ // Chegou  base (com CURRENT_SENSE o motor j foi desligado pela ISR)
+        motor_request(OUT_OFF);
+        position_set(0);
+        if (CAL_SEEK == cal_phase){
+          cal_phase = CAL_WAIT_UP;
+          cal_start = millis();
+        }
+        else { // Fim da calibrao: calcula e guarda os novos tempos de percurso
+          params = pos_params;
+          params.travel_up = (cal_up > params.kick_up) ? cal_up - params.kick_up : 0;
+          params.travel_down = (elapsed > params.kick_down) ? elapsed - params.kick_down : 0;
+          cal_result = position_configure(&params) ? CAL_OK : CAL_FAILED;
+          goto_state(IDLE);
+        }
+      }
+      else if (!motor_on()){ // (idem)
+        cal_start = millis();
+      }
+      else if (elapsed > CAL_TIMEOUT){ // Nunca chegou  base
+        goto_state(IDLE); // (a sada do estado regista a falha)
+      }break;
+
+    case CAL_WAIT_UP:
+    case CAL_WAIT_DOWN:
+      if (elapsed >= CAL_PAUSE){ // Terminou a pausa: passa  fase seguinte (subida ou descida)
+        cal_phase++;
+        cal_start = millis();
+        supervisor_arm(run_limit(CALIBRATE)); // Cada percurso da calibrao  um movimento
+        motor_request((CAL_UP == cal_phase) ? OUT_UP : OUT_DOWN);
+      }break;
+
+    case CAL_UP:
+      if (endstop_top()){ // Chegou ao topo
+        motor_request(OUT_OFF);
+        position_set(MAX_HEIGHT);
+        cal_up = (elapsed > 0xFFFF) ? 0xFFFF : elapsed;
+        cal_phase = CAL_WAIT_DOWN;
+        cal_start = millis();
+      }
+      else if (!motor_on()){ // A cronometragem s comea com o motor ligado (depois de o rel da direo comutar)
+        cal_start = millis();
+      }
+      else if (elapsed > CAL_TIMEOUT){ // Nunca chegou ao topo
+        goto_state(IDLE);
+      }break;
+  }
+}
+
+/* Condies das transies (ver states[]) */
+uint8_t init_done (void){ return timer_expired(TMR_INIT) || endstop_top(); } // J passou o tempo de inicializao ou chegou ao topo
+uint8_t close_request (void){ return RE_CloseBtn && position_height(); } // Quer-se fechar e ainda no est fechado
+uint8_t open_request (void){ return RE_OpenBtn && MAX_HEIGHT != position_height(); } // Quer-se abrir e ainda no est aberto
+uint8_t closed (void){ return !position_height(); } // J fechou completamente
+uint8_t opened (void){ return MAX_HEIGHT == position_height(); } // J abriu completamente
+uint8_t close_released (void){ return !CloseBtn; } // Largou o boto de fecho antes do tempo (clique rpido)
+uint8_t open_released (void){ return !OpenBtn; } // Largou o boto de abertura antes do tempo (clique rpido)
+uint8_t check_timeout (void){ return timer_expired(TMR_CLICK); } // J passou o tempo de deciso (clique lento)
+uint8_t open_btn (void){ return OpenBtn; } // Boto de abertura premido
+uint8_t close_btn (void){ return CloseBtn; } // Boto de fecho premido
+uint8_t open_auto_stop (void){ return MAX_HEIGHT == position_height() || OpenBtn; } // Abriu ou voltou-se a carregar no boto de abrir
+uint8_t close_auto_stop (void){ return !position_height() || CloseBtn; } // Fechou ou voltou-se a carregar no boto de fechar
+uint8_t close_manual_stop (void){ return !CloseBtn || !position_height() || OpenBtn; } // Largou o boto, fechou ou carregou no boto de abertura
+uint8_t open_manual_stop (void){ return !OpenBtn || MAX_HEIGHT == position_height() || CloseBtn; } // Largou o boto, abriu ou carregou no boto de fecho
+uint8_t x_arrived (void){ // A persiana para na altura de referncia se o motor desligar agora (ou passou-a)
+  uint16_t h = position_height();
+
+  if (OUT_UP == x_dir){
+    return (uint32_t)h + pos_stop_up >= height_reference;
+  }
+  if (OUT_DOWN == x_dir){
+    return h <= (uint32_t)height_reference + pos_stop_down;
+  }
+  return 1;
+}
+uint8_t any_press (void){ return RE_OpenBtn || RE_CloseBtn; } // Qualquer boto foi premido
+
+/* Aes de entrada e de sada dos estados */
+void init_enter (void){ // Tempo mximo para abrir totalmente
+  uint32_t init_time = param[PARAM_INIT_TIME];
+
+  if (pos_params.travel_up != MAX_HEIGHT){ // Se a persiana foi calibrada, s  preciso o tempo de subida medido
+    init_time = (uint32_t)pos_params.travel_up + pos_params.kick_up + (pos_params.travel_up >> 4); // (mais 6% de margem)
+  }
+  timer_start(TMR_INIT, (init_time > 0xFFFF) ? 0xFFFF : init_time);
+}
+
+void init_exit (void){
+  position_set(MAX_HEIGHT); // a persiana est garantidamente aberta
+  rehomes = 0; // (qualquer sada da inicializao conta como recuperao)
+}
+
+void check_enter (void){
+  timer_start(TMR_CLICK, param[PARAM_CHECK_TIME]); // inicializa contagem do tempo que se mantm o boto carregado
+}
+
+void open_x_enter (void){ // O sentido  decidido uma s vez,  entrada
+  uint16_t h = position_height();
+
+  if (((h > height_reference) ? h - height_reference : height_reference - h) <= OPEN_X_DEADBAND){
+    x_dir = OUT_OFF; // J est na altura de referncia (transita para IDLE na prxima passagem)
+  }
+  else {
+    x_dir = (h < height_reference) ? OUT_UP : OUT_DOWN;
+  }
+  motor_request(x_dir);
+}
+
+void calibrate_enter (void){
+  cal_phase = CAL_SEEK;
+  cal_result = CAL_RUNNING;
+  cal_start = millis();
+}
+
+void calibrate_exit (void){
+  if (CAL_RUNNING == cal_result){ // Cancelada por um boto ou comando, ou fora do tempo mximo
+    cal_result = CAL_FAILED;
+  }
+}
+
+#define TRANSITIONS(t) t, sizeof(t)/sizeof(t[0]) // Lista de transies e respetivo nmero
+
+static const transition_t init_next[] PROGMEM = {{init_done, IDLE}};
+static const transition_t idle_next[] PROGMEM = {{close_request, CLOSE_CHECK}, {open_request, OPEN_CHECK}};
+static const transition_t close_check_next[] PROGMEM = {{closed, IDLE}, {close_released, CLOSE_AUTO}, {check_timeout, CLOSE_MANUAL}, {open_btn, IDLE}};
+static const transition_t open_check_next[] PROGMEM = {{opened, IDLE}, {open_released, OPEN_AUTO}, {check_timeout, OPEN_MANUAL}, {close_btn, IDLE}};
+static const transition_t open_auto_next[] PROGMEM = {{open_auto_stop, IDLE}, {close_btn, CLOSE_CHECK}};
+static const transition_t close_auto_next[] PROGMEM = {{close_auto_stop, IDLE}, {open_btn, OPEN_CHECK}};
+static const transition_t close_manual_next[] PROGMEM = {{close_manual_stop, IDLE}};
+static const transition_t open_manual_next[] PROGMEM = {{open_manual_stop, IDLE}};
+static const transition_t open_x_next[] PROGMEM = {{x_arrived, IDLE}}; // (nunca inverte para corrigir)
+static const transition_t calibrate_next[] PROGMEM = {{any_press, IDLE}}; // Qualquer boto cancela a calibrao
+
+static const state_desc_t states[STATE_COUNT] PROGMEM = {
+  [INIT] = {OUT_UP, init_enter, init_exit, NULL, TRANSITIONS(init_next)}, // Abre totalmente a persiana e ignora comandos do utilizador
+  [IDLE] = {OUT_OFF, NULL, NULL, NULL, TRANSITIONS(idle_next)}, // Espera por qualquer ao
+  [CLOSE_CHECK] = {OUT_DOWN, check_enter, NULL, NULL, TRANSITIONS(close_check_next)}, // Fecha e verifica quanto tempo se prime o boto
+  [OPEN_CHECK] = {OUT_UP, check_enter, NULL, NULL, TRANSITIONS(open_check_next)}, // Abre e verifica quanto tempo se prime o boto
+  [OPEN_AUTO] = {OUT_UP, NULL, NULL, NULL, TRANSITIONS(open_auto_next)}, // Abre at a persiana ficar completamente aberta
+  [CLOSE_AUTO] = {OUT_DOWN, NULL, NULL, NULL, TRANSITIONS(close_auto_next)}, // Fecha at a persiana ficar completamente fechada
+  [CLOSE_MANUAL] = {OUT_DOWN, NULL, NULL, NULL, TRANSITIONS(close_manual_next)}, // Fecha at deixar de premir o boto
+  [OPEN_MANUAL] = {OUT_UP, NULL, NULL, NULL, TRANSITIONS(open_manual_next)}, // Abre at deixar de premir o boto
+  [OPEN_X] = {OUT_KEEP, open_x_enter, NULL, NULL, TRANSITIONS(open_x_next)}, // Abre/fecha at X% da altura (height_reference)
+  [CALIBRATE] = {OUT_DOWN, calibrate_enter, calibrate_exit, calibrate, TRANSITIONS(calibrate_next)}, // Calibrao dos tempos de percurso
+};
+
+/* Tempo mximo de motor ligado num movimento no estado "next" (ver
+ * supervisor.h): o percurso completo mais lento, com o atraso de
+ * arranque, e 12.5% de margem (mais do que TMR_INIT na
+ * inicializao). Cada percurso da calibrao pode durar at
+ * CAL_TIMEOUT, por no se conhecer ainda a persiana */
+uint16_t run_limit (uint8_t next){
+  uint32_t travel = (pos_params.travel_up > pos_params.travel_down) ? pos_params.travel_up : pos_params.travel_down;
+  uint32_t kick = (pos_params.kick_up > pos_params.kick_down) ? pos_params.kick_up : pos_params.kick_down;
+  uint32_t limit = travel + kick + (travel >> 3);
+
+  if (CALIBRATE == next){
+    limit = CAL_TIMEOUT + (CAL_TIMEOUT >> 3);
+  }
+  return (limit > 0xFFFF) ? 0xFFFF : limit;
+}
+
+/* Trata uma falha (FAULT_*, ver supervisor.h): regista-a e volta a
+ * inicializar a persiana ou, depois de SUP_REHOME_MAX tentativas
+ * seguidas, desliga o motor e fica no estado ILLEGAL */
+void recover (uint8_t code, uint8_t at){
+  supervisor_log(code, at, position_height());
+  if (rehomes < SUP_REHOME_MAX){
+    rehomes++;
+    goto_state(INIT);
+  }
+  else {
+    state = ILLEGAL; // (sem ao de sada: o estado atual pode ser o da falha)
+    motor_request(OUT_OFF);
+  }
+}
+
+/* Entra num estado: escreve as sadas, arma o tempo mximo do
+ * movimento e executa a ao de entrada. Um estado fora da tabela 
+ * uma falha (FAULT_STATE) */
+void enter_state (uint8_t next){
+  action_t enter;
+  uint8_t outputs;
+
+  if (next >= STATE_COUNT){
+    state = ILLEGAL;
+    recover(FAULT_STATE, next);
+    return;
+  }
+  state = next;
+  supervisor_arm(run_limit(next));
+  outputs = pgm_read_byte(&states[next].outputs);
+  if (OUT_KEEP != outputs){
+    motor_request(outputs);
+  }
+  enter = pgm_read_ptr(&states[next].enter);
+  if (enter){
+    enter();
+  }
+}
+
+/* Sai do estado atual (executando a ao de sada) e entra em "next" */
+void goto_state (uint8_t next){
+  action_t leave;
+
+  if (state < STATE_COUNT){
+    leave = pgm_read_ptr(&states[state].exit);
+    if (leave){
+      leave();
+    }
+  }
+  enter_state(next);
+}
+
+/* Uma passagem da mquina de estados: segue a primeira transio do
+ * estado atual cuja condio  verdadeira, ou executa a ao de
+ * passagem do estado se nenhuma for */
+void state_step (void){
+  const transition_t *t;
+  uint8_t n;
+  action_t run;
+
+  if (state >= STATE_COUNT){ // Estado ilegal ou imprevisto
+    if (ILLEGAL != state){ // (varivel corrompida)
+      uint8_t at = state;
+
+      state = ILLEGAL;
+      recover(FAULT_STATE, at);
+    }
+    else if (any_press()){ // Parado depois de falhas repetidas: um boto volta a tentar
+      goto_state(INIT);
+    }
+    return;
+  }
+
+  t = pgm_read_ptr(&states[state].transitions);
+  for (n = pgm_read_byte(&states[state].count); n; n--, t++){
+    if (((predicate_t)pgm_read_ptr(&t->when))()){
+      goto_state(pgm_read_byte(&t->next));
+      return;
+    }
+  }
+
+  run = pgm_read_ptr(&states[state].run);
+  if (run){
+    run();
+  }
+}
+
+#ifdef DEBUG
+/* Imprime o estado atual, no mesmo formato do antigo printf, mas sem
+ * printf: cada campo  escrito diretamente no buffer de transmisso */
+static void debug_print (void){
+  usart_puts_P(PSTR("((STATE:"));
+  usart_put_dec(state);
+  usart_puts_P(PSTR("; height:"));
+  usart_put_dec(position_height());
+  usart_puts_P(PSTR("; Input:"));
+  usart_tx_put(USB_input ? USB_input : ' ');
+  usart_puts_P(PSTR("; timers:"));
+  usart_put_hex(timer_events);
+  usart_puts_P(PSTR("; OPEN:"));
+  usart_put_dec(OpenBtn);
+  usart_puts_P(PSTR("  CLOSE:"));
+  usart_put_dec(CloseBtn);
+  usart_puts_P(PSTR("  MOTOR:"));
+  usart_put_dec(hal_motor_on());
+  usart_puts_P(PSTR("  DIR "));
+  usart_put_dec(hal_dir_up());
+  usart_puts_P(PSTR("))\n"));
+}
+#endif
+
+/* Junta o estado do motor, direo e botes nos bits TLM_IO_* */
+uint8_t io_flags (void){
+  uint8_t io = 0;
+
+  if (hal_motor_on()) io |= TLM_IO_MOTOR;
+  if (hal_dir_up()) io |= TLM_IO_DIR;
+  if (OpenBtn) io |= TLM_IO_OPEN;
+  if (CloseBtn) io |= TLM_IO_CLOSE;
+  return io;
+}
+
+/* L a configurao da EEPROM e entra no estado inicial (chamada
+ * depois de configurar os pinos e antes de ativar as interrupes) */
+void controller_init (void){
+  bus_init(); // L o endereo deste n da EEPROM
+  params_init(); // L os parmetros da persiana da EEPROM (antes do estado inicial, que usa PARAM_INIT_TIME)
+  position_init(); // L os parmetros do modelo de posio da EEPROM
+  update_init(); // Retoma a receo de uma imagem nova da firmware, se interrompida
+  // Se a altura foi guardada com a persiana parada no  preciso inicializar
+  enter_state(position_restore() ? IDLE : INIT); // Estado inicial (sem ao de sada do estado anterior)
+
+  #ifdef DEBUG
+    usart_puts_P(PSTR("\n____________________|DEBUG ON|____________________\n"));
+  #endif
+}
+
+/* Uma passagem pelo ciclo principal. Devolve 1 se o estado mudou (as
+ * transies do novo estado devem ser avaliadas j na prxima passagem) */
+uint8_t controller_poll (void){
+  uint8_t last_state = state; // Estado no incio desta passagem
+
+  // Leitura de entradas no mesmo instante (estado e flancos j filtrados pela interrupo do timer)
+  uint8_t buttons;
+  uint8_t pressed;
+
+  buttons_read(&buttons, &pressed);
+  CloseBtn = (buttons & (1<<CLOSE)) != 0; // Botao de fecho (ativo a 1)
+  RE_CloseBtn = (pressed & (1<<CLOSE)) != 0; // Ativo no flanco ascendente do botao de fecho
+  OpenBtn = (buttons & (1<<OPEN)) != 0; // Botao de abertura (ativo a 1)
+  RE_OpenBtn = (pressed & (1<<OPEN)) != 0; // Ativo no flanco ascendente do botao de abertura
+
+  // Um fim de curso ativo indica a altura real da persiana, corrigindo o erro acumulado da estimativa
+  if (endstop_top() && MAX_HEIGHT != position_height()){
+    position_set(MAX_HEIGHT);
+  }
+  else if (endstop_bottom() && position_height()){
+    position_set(0);
+  }
+
+  uint8_t fault = supervisor_poll(); // Alimenta o watchdog
+  if (fault){ // A ISR desligou o motor por exceder o tempo mximo do movimento
+    recover(fault, state);
+  }
+
+  if (current_poll()){ // O motor bloqueou longe dos limites: um obstculo, no um fim de curso
+    supervisor_log(FAULT_STALL, state, position_height());
+    goto_state(IDLE);
+  }
+
+  /* A porta srie tem prioridade sobre os butes, portanto assim que algo  lido, 
+   * processado o que foi recebido e a mquina de estados  forada ao estado adequado */
+  if(rx_tail != rx_head){ // Se algo foi lido por porta srie fora a mquina de estados a responder de acordo
+    uint8_t head = rx_head; // Captura o que j foi recebido (a ISR pode continuar a escrever)
+    uint8_t tail = rx_tail;
+
+    while (tail != head){ // Processa todos os caracteres pendentes de uma s vez
+      USB_input = rx_buf[tail];
+      if (!protocol_feed(USB_input)){ // Se no pertence a uma trama
+        if (scene_byte(USB_input)){ //  uma cena, s aceite ponto-a-ponto (numa linha partilhada pode ser um byte de uma trama de outro n; l chega por CMD_SCENE)
+          uint16_t h = scene_height(USB_input - SCENE_BYTE);
+
+          if (BUS_MODE == BUS_P2P && !baud_trial && SCENE_NONE != h){ // (se este n participa nela; nunca  experincia, pode ser lixo)
+            goto_scheduled(h);
+          }
+        }
+#if BUS_MODE != BUS_RS485 // ou um comando de um s caracter (sem endereo s podem ser aceites se a linha no for partilhada ou o n foi selecionado)
+        else if (!baud_trial){ // (nem enquanto a velocidade no for confirmada: pode ser lixo)
+          process_input(USB_input);
+        }
+#endif
+      }
+      tail = (tail + 1) & RX_BUF_MASK;
+    }
+    rx_tail = tail; // Liberta o espao lido para a ISR
+  }
+  else if (rx_idle_ms > PROTO_TIMEOUT){ // Se uma trama ficou a meio h demasiado tempo
+    protocol_reset(); //  descartada
+  }
+  protocol_poll(); // Resposta que aguarda a janela deste n
+
+  uint16_t scheduled = schedule_poll(); // Verifica o horrio (s faz algo quando passa um minuto)
+  if (SCHED_NONE != scheduled){
+    goto_scheduled(scheduled);
+  }
+
+  update_poll(); // Reset para a imagem nova depois da resposta, ou confirma a imagem em execuo
+  baud_poll(); // Muda a velocidade da porta srie depois de enviar a resposta, ou volta  anterior
+
+  state_step(); // Avalia as transies do estado atual
+
+  // Altura guardada em EEPROM: vlida apenas enquanto a persiana est parada
+  if (IDLE == state && !position_moving()){ // (depois de acabar de deslizar)
+    position_save(); // (s escreve se a persiana se moveu)
+  }
+  else if (motor_on()){ // Motor ligado
+    position_invalidate();
+  }
+  position_poll(); // Escreve na EEPROM sem esperar
+  params_poll(); // (depois da altura, se a EEPROM ainda estiver livre)
+
+  #ifdef DEBUG
+    if (state != printfstate){
+      debug_print(); // ((STATE:%d; height:%d; Input:%c; timers:%02x; OPEN:%d  CLOSE:%d  MOTOR:%d  DIR %d))
+      printfstate = state;
+    }
+  #endif
+
+  if (telemetry_on){ // Envio de telemetria (s faz algo quando chega a altura do prximo registo)
+    uint32_t ms;
+    uint8_t sub;
+
+    timestamp(&ms, &sub);
+    telemetry_sample((uint16_t)ms, sub, state, position_height(), io_flags());
+  }
+
+  return state != last_state;
+}
@@ -0,0 +1,107 @@
+/*
+ * controller.h
+ *  Lgica de controlo da persiana (mquina de estados, comandos por
+ *  porta srie, calibrao e altura guardada), independente do
+ *  hardware (ver hal.h)
+ *
+ *  O programa (main.c na firmware, sim/sim.c na simulao) chama
+ *  controller_init() uma vez, controller_tick() a cada ms (na ISR
+ *  do timer 2), rx_put() por cada caracter recebido (na ISR de
+ *  receo) e controller_poll() em cada passagem pelo ciclo
+ *  principal.
+ */
+
+#ifndef CONTROLLER_H_
+#define CONTROLLER_H_
+
+#include <stdint.h>
+#include "serial.h"
+#include "bus.h"
+#include "clock.h"
+#include "buttons.h"
+#include "position.h"
+#include "motor.h"
+#include "timer.h"
+#include "supervisor.h"
+#include "current.h"
+
+// Nomes simbolicos para os estados
+#define INIT 0 // Inicializao
+#define IDLE 1 // Aguarda Comandos
+#define CLOSE_CHECK 2 // Fecha e decide entre manual e automtico
+#define OPEN_CHECK 3 // Abre e decide entre manual e automtico
+#define OPEN_AUTO 4 // Abre automaticamente
+#define CLOSE_AUTO 5 // Fecha automaticamente
+#define CLOSE_MANUAL 6 // Fecha manualmente
+#define OPEN_MANUAL 7 // Abre manualmente
+#define OPEN_X 8 // Abre/fecha at X% da altura mxima (altura de referncia)
+#define CALIBRATE 9 // Mede os tempos de percurso entre os fins de curso
+#define ILLEGAL 255 // Motor parado depois de falhas repetidas (sai com um boto ou um comando, ver supervisor.h)
+#define STATE_COUNT 10 // Nmero de estados descritos na tabela (INIT a CALIBRATE)
+
+#define FIRMWARE_VERSION 0x0203 // Verso da firmware (byte mais significativo principal, menos significativo secundrio), em CMD_STATUS
+
+#define RX_BUF_SIZE 32 // Tamanho do buffer de receo (tem de ser potncia de 2)
+#define RX_BUF_MASK (RX_BUF_SIZE-1) // Mscara para avanar os ndices do buffer de receo
+
+#if (RX_BUF_SIZE & RX_BUF_MASK) || (RX_BUF_SIZE > 256)
+#error "RX_BUF_SIZE tem de ser uma potncia de 2 at 256"
+#endif
+
+extern uint8_t state; // Estado atual
+extern uint16_t height_reference; // Altura de referncia (apenas pertinente no estado OPEN_X)
+extern volatile uint8_t rx_buf[RX_BUF_SIZE]; // Buffer circular de receo da porta srie
+extern volatile uint8_t rx_head; // Prxima posio a escrever no buffer (escrito apenas pela ISR)
+extern volatile uint8_t rx_tail; // Prxima posio a ler do buffer (escrito apenas pelo main)
+extern volatile uint16_t rx_overflow; // Nmero de caracteres perdidos por o buffer estar cheio
+extern volatile uint8_t rx_idle_ms; // Tempo (ms, satura em 255) desde o ltimo caracter recebido
+
+void controller_init(void);
+uint8_t controller_poll(void);
+uint16_t rx_overflows(void);
+
+/* H caracteres recebidos por processar */
+static inline uint8_t rx_pending (void){
+  return rx_tail != rx_head;
+}
+
+/* Guarda um caracter recebido no buffer (s deve ser chamada pela ISR de receo) */
+static inline void rx_put (uint8_t data){
+  uint8_t next = (rx_head + 1) & RX_BUF_MASK; // Posio seguinte do buffer
+
+  rx_idle_ms = 0; // Recomea a contagem do tempo sem receo
+
+  if (next != rx_tail){ // Se o buffer no est cheio
+    rx_buf[rx_head] = data; // guarda os dados...
+    rx_head = next; // ...e s depois os publica ao main
+  }
+  else if (rx_overflow != 0xFFFF){ // Se est cheio, o caracter perde-se
+    rx_overflow++; // e  contabilizado (satura no mximo)
+  }
+#if BUS_MODE == BUS_P2P
+  usart_tx_put(data); // Envia os dados que recebeu, de volta para o PC (sem esperar pelo transmissor)
+#endif
+}
+
+/* Trabalho feito a cada ms (s deve ser chamada pela ISR do timer 2) */
+static inline void controller_tick (void){
+  clock_tick(); // avana o relgio monotnico
+  buttons_tick(); // amostra e filtra os botes
+
+  position_tick(motor_level(), hal_dir_up()); // aumenta ou reduz a altura conforme o motor esteja a subir ou a descer (proporcionalmente ao PWM)
+  motor_tick(); // avana as inverses de sentido pendentes
+  if (supervisor_tick(hal_motor_on())){ // o motor excedeu o tempo mximo do movimento
+    motor_halt(); // (desligado j, mesmo que o ciclo principal no responda)
+  }
+  if (current_tick(hal_motor_on(), hal_dir_up())){ // o motor est bloqueado (fim de curso ou obstculo)
+    motor_halt();
+  }
+
+  timer_tick(); // avana os temporizadores por software
+
+  if (rx_idle_ms != 255){ // conta o tempo sem receo por porta srie
+    rx_idle_ms++;
+  }
+}
+
+#endif /* CONTROLLER_H_ */
@@ -0,0 +1,45 @@
+/*
+ * current.c
+ *  Medio da corrente do motor (ADC) e deteo dos fins de curso
+ *  (ver current.h)
+ */
+
+#include "current.h"
+
+volatile uint16_t cur_sum = 0;
+volatile uint8_t cur_count = 0;
+volatile uint16_t cur_level = 0;
+volatile uint16_t cur_on_ms = 0;
+volatile uint8_t cur_over = 0;
+volatile uint8_t cur_stall = CUR_NONE;
+volatile uint8_t cur_end = CUR_NONE;
+
+/* Trata um bloqueio detetado pela ISR do timer (que j desligou o
+ * motor): perto do limite no sentido do motor passa a ser o fim de
+ * curso. Devolve 1 se foi longe dos limites (um obstculo) */
+uint8_t current_poll (void){
+  uint8_t stall = cur_stall;
+  uint16_t h;
+
+  if (!CURRENT_SENSE || CUR_NONE == stall){
+    return 0;
+  }
+  cur_stall = CUR_NONE;
+
+  h = position_height();
+  if ((CUR_TOP == stall) ? (h >= MAX_HEIGHT - CUR_END_WINDOW) : (h <= CUR_END_WINDOW)){
+    cur_end = stall;
+    return 0;
+  }
+  return 1;
+}
+
+/* Nvel filtrado da corrente (Q4, 0 com o motor desligado h mais de um movimento) */
+uint16_t current_level (void){
+  uint16_t level;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // A ISR do ADC escreve-o em duas instrues
+    level = cur_level;
+  }
+  return level;
+}
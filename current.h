@@ -0,0 +1,123 @@
+/*
+ * current.h
+ *  Medio da corrente do motor (ADC) e deteo dos fins de curso
+ *  pelo aumento da corrente quando a persiana bate no limite
+ *
+ *  Ativa com CURRENT_SENSE a 1 (escolhido na compilao): o pino
+ *  CURRENT_ADC (ver hal_avr.h) recebe uma tenso proporcional 
+ *  corrente do motor (shunt e amplificador, ou um sensor com sada
+ *  retificada), entre 0 e AVcc.
+ *
+ *  Amostragem e filtro:
+ *   Enquanto o motor est ligado o ADC converte continuamente (modo
+ *   free-running, 125kHz, cerca de 9600 amostras por segundo) e cada
+ *   amostra (8 bits)  tratada na ISR do ADC (current_sample()), s
+ *   com somas e deslocamentos: CUR_DECIMATION amostras so somadas
+ *   (a mdia, em Q4) e cada soma entra num filtro passa-baixo de
+ *   primeira ordem, nvel += (soma - nvel) / 2^CUR_FILTER_SHIFT.
+ *   Com o motor desligado o ADC  desligado.
+ *
+ *  Deteo (na ISR do timer 2, current_tick()):
+ *   Nos primeiros CUR_BLANK ms depois de o motor ligar a corrente de
+ *   arranque  ignorada. Depois, um nvel acima de CUR_STALL_LEVEL
+ *   durante CUR_STALL_TIME ms  um motor bloqueado: a ISR desliga o
+ *   motor de imediato e o ciclo principal decide (current_poll()):
+ *   perto do fim do percurso no sentido do motor (a menos de
+ *   CUR_END_WINDOW)  o fim de curso, que passa a ser indicado por
+ *   endstop_top()/endstop_bottom() at o motor andar no outro
+ *   sentido, o que corrige a altura como um interruptor; longe dos
+ *   limites  um obstculo, uma falha (FAULT_STALL).
+ *   Os limites dependem do motor e do sensor: CUR_STALL_LEVEL  o
+ *   nico que normalmente tem de ser ajustado (CMD_GET_CURRENT mostra
+ *   o nvel durante um movimento).
+ */
+
+#ifndef CURRENT_H_
+#define CURRENT_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "position.h"
+
+#ifndef CURRENT_SENSE
+#define CURRENT_SENSE 0 // Sem medio de corrente
+#endif
+
+#define CUR_DECIMATION 16 // Amostras somadas por cada entrada do filtro (~1.7ms)
+#define CUR_FILTER_SHIFT 2 // Constante de tempo do filtro: 2^2 entradas (~7ms)
+#ifndef CUR_STALL_LEVEL
+#define CUR_STALL_LEVEL 160 // Nvel (0~255, como o ADC) acima do qual o motor est bloqueado
+#endif
+#define CUR_STALL_TIME 50 // ms acima de CUR_STALL_LEVEL at considerar o motor bloqueado
+#define CUR_BLANK 300 // ms depois de o motor ligar em que a corrente de arranque  ignorada
+#define CUR_END_WINDOW (MAX_HEIGHT/4) // Distncia ao limite dentro da qual um bloqueio  o fim de curso
+
+// Fim de curso detetado (cur_end) e sentido de um bloqueio (cur_stall)
+#define CUR_NONE 0
+#define CUR_TOP 1 // A subir / no topo
+#define CUR_BOTTOM 2 // A descer / na base
+
+extern volatile uint16_t cur_sum; // Soma das amostras em curso
+extern volatile uint8_t cur_count; // Amostras j somadas
+extern volatile uint16_t cur_level; // Nvel filtrado (Q4)
+extern volatile uint16_t cur_on_ms; // ms desde que o motor ligou (satura em CUR_BLANK)
+extern volatile uint8_t cur_over; // ms seguidos acima de CUR_STALL_LEVEL
+extern volatile uint8_t cur_stall; // Bloqueio por tratar (CUR_TOP ou CUR_BOTTOM, escrito pela ISR)
+extern volatile uint8_t cur_end; // Fim de curso detetado (CUR_TOP ou CUR_BOTTOM)
+
+uint8_t current_poll(void);
+uint16_t current_level(void);
+
+/* Trata uma amostra do ADC (s deve ser chamada pela ISR do ADC) */
+static inline void current_sample (uint8_t adc){
+  uint16_t sum = cur_sum + adc;
+
+  if (++cur_count < CUR_DECIMATION){
+    cur_sum = sum;
+    return;
+  }
+  cur_count = 0;
+  cur_sum = 0;
+  cur_level += ((int16_t)(sum - cur_level)) >> CUR_FILTER_SHIFT; // (soma de 16 amostras = mdia em Q4)
+}
+
+/* Vigia a corrente durante 1ms (s deve ser chamada pela ISR do timer
+ * 2). Devolve 1 no ms em que o motor  considerado bloqueado */
+static inline uint8_t current_tick (uint8_t motor, uint8_t up){
+  if (!CURRENT_SENSE){
+    return 0;
+  }
+  if (!motor){
+    if (cur_on_ms){ // Motor desligou: desliga o ADC
+      hal_adc_stop();
+      cur_on_ms = 0;
+      cur_over = 0;
+    }
+    return 0;
+  }
+  if (!cur_on_ms){ // Motor ligou: recomea o filtro e liga o ADC
+    cur_sum = 0;
+    cur_count = 0;
+    cur_level = 0;
+    hal_adc_start();
+    if (cur_end != (up ? CUR_TOP : CUR_BOTTOM)){ // Afasta-se do fim de curso detetado
+      cur_end = CUR_NONE;
+    }
+  }
+  if (cur_on_ms < CUR_BLANK){ // Corrente de arranque
+    cur_on_ms++;
+    return 0;
+  }
+  if ((cur_level >> 4) <= CUR_STALL_LEVEL){
+    cur_over = 0;
+    return 0;
+  }
+  if (++cur_over < CUR_STALL_TIME){
+    return 0;
+  }
+  cur_over = 0;
+  cur_stall = up ? CUR_TOP : CUR_BOTTOM;
+  return 1;
+}
+
+#endif /* CURRENT_H_ */
@@ -0,0 +1,44 @@
+/*
+ * endstop.h
+ *  Fins de curso da persiana (interruptores no topo e na base)
+ *
+ *  Os fins de curso so entradas ativas a 0 com pull-up interno, pelo
+ *  que um pino sem nada ligado  lido como inativo. Quando ENDSTOPS 
+ *  definido a 0 (persianas sem fins de curso) as funes devolvem
+ *  sempre 0 e o compilador elimina o cdigo que depende delas.
+ *  Com CURRENT_SENSE a 1 os fins de curso detetados pela corrente do
+ *  motor (current.h) so indicados da mesma forma, com ou sem
+ *  interruptores.
+ */
+
+#ifndef ENDSTOP_H_
+#define ENDSTOP_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "current.h"
+
+#ifndef ENDSTOPS
+#define ENDSTOPS 1 // Fins de curso ligados
+#endif
+
+#define END_DETECT (ENDSTOPS || CURRENT_SENSE) // H alguma forma de detetar os limites do percurso
+
+/* Configura os pinos dos fins de curso como entradas com pull-up */
+static inline void endstop_init (void){
+#if ENDSTOPS
+  hal_endstop_init(); // (pinos ENDSTOP_TOP e ENDSTOP_BOTTOM, ver hal_avr.h)
+#endif
+}
+
+/* A persiana est completamente aberta */
+static inline uint8_t endstop_top (void){
+  return (ENDSTOPS && hal_endstop_top()) || (CURRENT_SENSE && CUR_TOP == cur_end);
+}
+
+/* A persiana est completamente fechada */
+static inline uint8_t endstop_bottom (void){
+  return (ENDSTOPS && hal_endstop_bottom()) || (CURRENT_SENSE && CUR_BOTTOM == cur_end);
+}
+
+#endif /* ENDSTOP_H_ */
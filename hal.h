@@ -0,0 +1,27 @@
+/*
+ * hal.h
+ *  Camada de acesso ao hardware
+ *
+ *  Os mdulos do controlador (controller.c, motor, botes, fins de
+ *  curso, posio, relgio, protocolo...) no acedem diretamente aos
+ *  registos: usam as funes hal_* e a interface da avr-libc para a
+ *  EEPROM, memria de programa, blocos atmicos e CRC. Na firmware
+ *  estas so as de hal_avr.h (funes inline, sem qualquer custo em
+ *  relao ao acesso direto); na simulao nativa (compilada com
+ *  SIM definido) so as de sim/hal_sim.h, que leem e escrevem o
+ *  estado do modelo da persiana.
+ *  Apenas main.c (configurao dos perifricos, rotinas de
+ *  interrupo e sleep) e serial.c (driver da porta srie) so
+ *  especficos do AVR; na simulao so substitudos por sim/.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#ifdef SIM
+#include "sim/hal_sim.h"
+#else
+#include "hal_avr.h"
+#endif
+
+#endif /* HAL_H_ */
@@ -0,0 +1,276 @@
+/*
+ * hal_avr.h
+ *  Acesso ao hardware do ATmega328p (ver hal.h)
+ */
+
+#ifndef HAL_AVR_H_
+#define HAL_AVR_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include "boot/boot.h"
+
+#ifndef MOTOR_PWM
+#define MOTOR_PWM 0 // Motor ligado/desligado (1 -> PWM no timer 1, ver motor.h)
+#endif
+
+// Pinos
+#if MOTOR_PWM
+#define MOTOR PB2 // Pino OC1B do motor em PWM (ativo a 0)
+#else
+#define MOTOR PB0 // Posio respetiva ao pino do motor (ativo a 0)
+#endif
+#define DIR PB1 // Posio respetiva ao pino da direo do motor (1 vai para cima, 0 vai para baixo)
+#define BUS_DE PD2 // Pino de driver enable do transcetor RS-485 (ativo a 1)
+#define ENDSTOP_TOP PD4 // Posio respetiva ao pino do fim de curso superior (ativo a 0)
+#define ENDSTOP_BOTTOM PD5 // Posio respetiva ao pino do fim de curso inferior (ativo a 0)
+#define CLOSE PD6 // Posio respetiva ao pino do boto de fecho (ativo a 0)
+#define OPEN PD7 // Posio respetiva ao pino do boto de abertura (ativo a 0)
+#if MOTOR_PWM
+#define PROFILE_TICK PB0 // (PB2  a sada PWM do motor)
+#else
+#define PROFILE_TICK PB2 // Pino de medio da ISR do timer 2 (apenas na build PROFILE)
+#endif
+#define PROFILE_RX PB3 // Pino de medio da ISR de receo (apenas na build PROFILE)
+#define CURRENT_ADC 0 // Canal do ADC (PC0) ligado ao sensor de corrente do motor (apenas com CURRENT_SENSE)
+#define PULSE_A PD3 // Pino INT1 dos impulsos do sensor de posio (apenas com POS_SOURCE diferente de POS_TIME)
+#define PULSE_B PC1 // Pino do canal B do encoder (apenas com POS_SOURCE a POS_QUADRATURE)
+
+/* Build PROFILE (make PROFILE=1): cada pino de medio fica a 1
+ * enquanto a ISR respetiva corre, para medir a durao e o jitter
+ * num analisador lgico. Cada mudana  uma s instruo (sbi/cbi, 2
+ * ciclos); o prlogo e o eplogo da ISR (que guardam e repem os
+ * registos, ver a listagem do make disasm) ficam fora do impulso.
+ * Sem PROFILE as macros no geram cdigo */
+#ifdef PROFILE
+#define PROFILE_ENTER(pin) (PORTB |= (1<<(pin)))
+#define PROFILE_EXIT(pin) (PORTB &= ~(1<<(pin)))
+#else
+#define PROFILE_ENTER(pin)
+#define PROFILE_EXIT(pin)
+#endif
+
+/* Configura os pinos de medio como sadas a 0 (apenas na build PROFILE) */
+static inline void hal_profile_init (void){
+#ifdef PROFILE
+  PORTB &= ~((1<<PROFILE_TICK) | (1<<PROFILE_RX));
+  DDRB |= (1<<PROFILE_TICK) | (1<<PROFILE_RX);
+#endif
+}
+
+/* Configura os pinos do motor e da direo como sadas, com o motor
+ * desligado. Com MOTOR_PWM o timer 1 fica em fast PWM de 10 bits sem
+ * prescaler (15.6kHz, acima do audvel), com a sada OC1B desligada
+ * do pino at o motor ligar */
+static inline void hal_motor_init (void){
+  PORTB |= (1<<MOTOR); // Garante que o motor est, inicialmente, desligado
+  DDRB |= (1<<MOTOR) | (1<<DIR);
+#if MOTOR_PWM
+  TCCR1A = (1<<WGM11) | (1<<WGM10); // Fast PWM 10 bits (WGM13:0 = 0111), OC1B desligado
+  TCCR1B = (1<<WGM12) | (1<<CS10); // Sem prescaler (CS12:0 = 001)
+#endif
+}
+
+#if MOTOR_PWM
+/* O motor est ligado (OC1B ligado ao pino) */
+static inline uint8_t hal_motor_on (void){
+  return (TCCR1A & (1<<COM1B1)) != 0;
+}
+
+/* Liga (1) ou desliga (0) o motor: ligado, o pino segue OC1B em modo
+ * invertido (a 0 durante duty/255 do perodo) */
+static inline void hal_motor_set (uint8_t on){
+  if (on){
+    TCCR1A |= (1<<COM1B1) | (1<<COM1B0);
+  }
+  else {
+    TCCR1A &= ~((1<<COM1B1) | (1<<COM1B0)); // O pino volta a PORTB, a 1
+  }
+}
+
+/* Duty cycle do motor ligado (0 a 255, 255 sempre ligado) */
+static inline void hal_motor_duty (uint8_t duty){
+  OCR1B = ((uint16_t)duty << 2) | 3; // 255 -> 1023 (TOP): sada sempre a 0
+}
+#else
+/* O motor est ligado */
+static inline uint8_t hal_motor_on (void){
+  return !(PORTB & (1<<MOTOR));
+}
+
+/* Liga (1) ou desliga (0) o motor */
+static inline void hal_motor_set (uint8_t on){
+  if (on){
+    PORTB &= ~(1<<MOTOR);
+  }
+  else {
+    PORTB |= (1<<MOTOR);
+  }
+}
+
+/* Sem PWM o motor est sempre ligado a 100% */
+static inline void hal_motor_duty (uint8_t duty){ }
+#endif
+
+/* A direo est para cima (abre) */
+static inline uint8_t hal_dir_up (void){
+  return (PORTB >> DIR) & 1;
+}
+
+/* Muda a direo: 1 para cima (abre), 0 para baixo (fecha) */
+static inline void hal_dir_set (uint8_t up){
+  if (up){
+    PORTB |= (1<<DIR);
+  }
+  else {
+    PORTB &= ~(1<<DIR);
+  }
+}
+
+/* Configura os pinos dos botes como entradas */
+static inline void hal_buttons_init (void){
+  DDRD &= ~((1<<CLOSE) | (1<<OPEN));
+}
+
+/* Botes premidos (bits CLOSE e OPEN a 1), sem filtragem */
+static inline uint8_t hal_buttons (void){
+  return ~PIND & ((1<<CLOSE) | (1<<OPEN));
+}
+
+/* Configura os pinos dos fins de curso como entradas com pull-up */
+static inline void hal_endstop_init (void){
+  DDRD &= ~((1<<ENDSTOP_TOP) | (1<<ENDSTOP_BOTTOM));
+  PORTD |= (1<<ENDSTOP_TOP) | (1<<ENDSTOP_BOTTOM);
+}
+
+/* Fim de curso superior ativo */
+static inline uint8_t hal_endstop_top (void){
+  return !(PIND & (1<<ENDSTOP_TOP));
+}
+
+/* Fim de curso inferior ativo */
+static inline uint8_t hal_endstop_bottom (void){
+  return !(PIND & (1<<ENDSTOP_BOTTOM));
+}
+
+/* Configura os pinos do sensor de posio como entradas com pull-up
+ * e liga a interrupo INT1 nos flancos ascendentes do canal A */
+static inline void hal_pulse_init (uint8_t quadrature){
+  DDRD &= ~(1<<PULSE_A);
+  PORTD |= (1<<PULSE_A);
+  if (quadrature){
+    DDRC &= ~(1<<PULSE_B);
+    PORTC |= (1<<PULSE_B);
+  }
+  EICRA |= (1<<ISC11) | (1<<ISC10); // Flanco ascendente (ISC11:0 = 11)
+  EIFR = (1<<INTF1); // Desliga a flag, se ativa (escrevendo 1)
+  EIMSK |= (1<<INT1);
+}
+
+/* Nvel do canal B do encoder */
+static inline uint8_t hal_pulse_b (void){
+  return PINC & (1<<PULSE_B);
+}
+
+/* Configura o divisor da porta srie (u2x a 1 -> 8 amostras por bit, ver baud.h) */
+static inline void hal_usart_baud (uint16_t ubrr, uint8_t u2x){
+  UBRR0 = ubrr;
+  if (u2x){
+    UCSR0A |= (1<<U2X0);
+  }
+  else {
+    UCSR0A &= ~(1<<U2X0);
+  }
+}
+
+/* Configura timer 2 para gerar uma interrupo a cada top+1 contagens de 8us (ver clock.c) */
+static inline void hal_timer_init (uint8_t top){
+  TCCR2B = 0; // Para o timer
+  TCNT2 = 0; // Contagem comea em 0
+  OCR2A = top; // top+1 contagens por perodo
+  TIFR2 = (1<<OCF2B) | (1<<OCF2A) | (1<<TOV2); // Desliga quaisquer flags que estejam ativas (escrevendo 1)
+  TCCR2A = (1<<WGM21); // Modo CTC (WGM22:0 = 010), sadas OC2A/OC2B desligadas
+  TIMSK2 = (1<<OCIE2A); // Permite interrupo por comparao com OCR2A
+  TCCR2B = (1<<CS22) | (1<<CS20); // Inicia o timer com prescaler TP=128 (CS22:0 = 101)
+}
+
+/* Contagem atual do timer 2 */
+static inline uint8_t hal_timer_count (void){
+  return TCNT2;
+}
+
+/* H uma interrupo do timer 2 pendente (ainda no atendida) */
+static inline uint8_t hal_timer_pending (void){
+  return TIFR2 & (1<<OCF2A);
+}
+
+/* Liga o ADC em modo free-running no pino CURRENT_ADC, com
+ * interrupo em cada converso (ver current.h) */
+static inline void hal_adc_start (void){
+  DIDR0 = (1<<CURRENT_ADC); // Sem buffer digital no pino analgico
+  ADMUX = (1<<REFS0) | (1<<ADLAR) | CURRENT_ADC; // Referncia AVcc, resultado em ADCH (8 bits)
+  ADCSRB = 0; // Free-running: cada converso comea no fim da anterior
+  ADCSRA = (1<<ADEN) | (1<<ADSC) | (1<<ADATE) | (1<<ADIE) | (1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0); // 16MHz/128 = 125kHz, 13 ciclos por converso
+}
+
+/* Desliga o ADC */
+static inline void hal_adc_stop (void){
+  ADCSRA = 0;
+}
+
+/* ltima converso do ADC (8 bits mais significativos) */
+static inline uint8_t hal_adc_read (void){
+  return ADCH;
+}
+
+/* Liga o watchdog: sem hal_wdt_reset() durante 250ms o CPU faz reset */
+static inline void hal_wdt_init (void){
+  wdt_enable(WDTO_250MS);
+}
+
+/* Alimenta o watchdog */
+static inline void hal_wdt_reset (void){
+  wdt_reset();
+}
+
+/* Imagem da firmware em execuo (0 A, 1 B), escolhida pelo
+ * bootloader (ver boot/boot.h) */
+static inline uint8_t hal_boot_slot (void){
+  return GPIOR0 & 1;
+}
+
+/* Um endereo fixo na EEPROM, acima das variveis EEMEM (que o
+ * linker coloca a partir de 0, pela ordem dos ficheiros) */
+static inline void *hal_eeprom_fixed (uint16_t addr){
+  return (void *)(uintptr_t)addr;
+}
+
+/* Registo de arranque partilhado com o bootloader (endereo na EEPROM) */
+static inline void *hal_boot_record (void){
+  return (void *)BOOT_RECORD_ADDR;
+}
+
+/* L um byte da flash */
+static inline uint8_t hal_flash_read (uint16_t addr){
+  return pgm_read_byte(addr);
+}
+
+/* Escreve uma pgina da flash no slot que no est em execuo,
+ * atravs do bootloader (as interrupes ficam desligadas cerca de
+ * 9ms) */
+static inline void hal_flash_write (uint16_t addr, const uint8_t *buf){
+  ((void (*)(uint16_t, const uint8_t *))(BOOT_API_WRITE / 2))(addr, buf); // (endereo em palavras)
+}
+
+/* Faz reset pelo watchdog */
+static inline void hal_reset (void){
+  wdt_enable(WDTO_15MS);
+  for (;;);
+}
+
+#endif /* HAL_AVR_H_ */
@@ -34,13 +34,91 @@
  *   -Considerou-se que o tempo que a persiana demora a abrir
  *   de 13,2s (cronometrado) e que a sua velocidade de subida
  *  permanece constante, o que no  verdade e gera um erro
- *  cumulativo.
- *   -Considerou-se que a persiana consegue mudar de direo
- *  enquanto o motor est ligado, sem qualquer problema e sem
- *  atrasos. Infelizmente, como a mudana de direo implica uma
- *  mudana brusca da fase a que a persiana est ligada, esta
- *  troca pode, eventualmente, estragar a persiana. Deve-se,
- *  assim, evitar estas transies perigosas.
+ *  cumulativo. Para o reduzir, a posio  estimada com tempos de
+ *  percurso diferentes a subir e a descer e com o atraso de
+ *  arranque do motor em cada sentido (position.c), parmetros
+ *  guardados em EEPROM e configurveis por porta srie.
+ *   -Os tempos de percurso podem ser medidos automaticamente
+ *  (comando CMD_CALIBRATE) se a persiana tiver fins de curso
+ *  (endstop.h): a persiana fecha at ao fim de curso inferior,
+ *  abre at ao superior e volta a fechar, cronometrando a subida e
+ *  a descida, e os tempos medidos so guardados em EEPROM. Parar
+ *  num fim de curso corrige tambm a altura estimada, e a
+ *  inicializao passa a durar apenas o tempo de subida calibrado
+ *  (ou at o fim de curso superior ser atingido).
+ *   -No estado OPEN_X (altura de referncia) o sentido  decidido
+ *  uma s vez,  entrada, e o motor  desligado antes de chegar 
+ *  altura de referncia,  distncia que a persiana ainda vai
+ *  deslizar (position.h), para que pare nela sem a ultrapassar.
+ *  Se a altura atual j est a menos de OPEN_X_DEADBAND da
+ *  referncia a persiana no se move, e nunca inverte para corrigir
+ *  o erro final; assim no h oscilaes em torno da referncia.
+ *   -A altura  guardada em EEPROM sempre que a persiana para
+ *  (IDLE) e invalidada assim que o motor volta a ligar. No arranque,
+ *  se houver uma altura guardada vlida, a inicializao  saltada
+ *  e a persiana fica imediatamente pronta a receber comandos; s se
+ *  a energia falhou com o motor ligado  que volta a inicializar.
+ *   -Os botes no so lidos diretamente no ciclo principal: so
+ *  amostrados e filtrados (debounce) na interrupo do timer
+ *  (buttons.h), que publica o seu estado estvel e os flancos de
+ *  presso. Os ressaltos dos contactos no geram falsos cliques (que
+ *  poderiam iniciar e logo parar um movimento) e um clique vale o
+ *  mesmo seja qual for a velocidade do ciclo principal.
+ *   -No fim de cada passagem pelo ciclo principal, se no houver
+ *  caracteres por processar e o estado no mudou, o CPU adormece
+ *  (SLEEP_MODE_IDLE) at  prxima interrupo: o timer de 1ms, a
+ *  receo por porta srie ou a mudana de um dos botes. Como tudo
+ *  o que pode provocar uma transio de estado chega por uma destas
+ *  interrupes, cada uma acorda o CPU para uma nica passagem pela
+ *  mquina de estados, sem atrasar a reao em mais do que o tempo
+ *  de acordar. Os perifricos que no so usados (ADC sem
+ *  CURRENT_SENSE, comparador, SPI, TWI, timer 0 e o timer 1, exceto
+ *  com MOTOR_PWM ou na build de medio BENCH) so desligados. O
+ *  modo power-save, que pouparia mais, no  usado porque sem um
+ *  cristal de 32kHz o timer 2 no funciona nesse modo e a porta
+ *  srie no acorda o CPU.
+ *   -Mudar de direo com o motor ligado implica uma mudana
+ *  brusca da fase a que a persiana est ligada, o que pode,
+ *  eventualmente, estragar a persiana. Por isso os estados apenas
+ *  pedem as sadas que querem (motor.h) e  o escalonador do motor,
+ *  a cada ms, que nas inverses desliga o motor, espera um tempo
+ *  morto, muda a direo, espera que o rel comute e s ento volta
+ *  a ligar o motor. Uma inverso (OPEN_AUTO -> CLOSE_CHECK, por
+ *  exemplo) custa apenas esse atraso.
+ *   -Um n numa instalao no pode ficar bloqueado  espera de
+ *  que lhe desliguem a alimentao: o watchdog faz reset se o ciclo
+ *  principal parar, a ISR do timer desliga o motor se um movimento
+ *  exceder o percurso completo mais lento (com margem), e um estado
+ *  imprevisto deixou de bloquear o sistema no estado ilegal. Cada
+ *  falha fica registada em EEPROM e a persiana volta a inicializar
+ *  (supervisor.h).
+ *   -A altura estimada pelo tempo acumula erro, e sem fins de curso
+ *  um movimento automtico at um limite s para quando a
+ *  estimativa l chega. Compilando com CURRENT_SENSE a 1 a corrente
+ *  do motor  amostrada pelo ADC (em interrupo, com um filtro em
+ *  vrgula fixa), e o aumento da corrente quando a persiana bate no
+ *  limite para o motor de imediato e corrige a altura, como um fim
+ *  de curso (current.h).
+ *   -Em persianas com um sensor de hall ou um encoder no motor
+ *  (POS_SOURCE a POS_HALL ou POS_QUADRATURE) a altura deixa de ser
+ *  estimada pelo tempo e passa a ser contada pelos impulsos do
+ *  sensor, na interrupo INT1, sem erro acumulado. O resto do
+ *  programa usa a mesma altura nos dois casos (position.h).
+ *   -Compilando com MOTOR_PWM a 1 o motor  comandado em PWM pelo
+ *  timer 1 (pino OC1B), com rampas de acelerao e desacelerao em
+ *  vez de arrancar e parar em binrio mximo: menos desgaste da
+ *  caixa redutora e uma distncia de paragem sempre igual, que o
+ *  estado OPEN_X desconta (motor.h).
+ *   -Com o bootloader (boot/) a firmware pode ser atualizada pela
+ *  prpria linha srie, para todos os ns de uma vez (CMD_FW_*): a
+ *  imagem nova  escrita no slot de flash que no est em execuo,
+ *  sem parar a persiana, e s passa a ser a confirmada depois de
+ *  arrancar e funcionar algum tempo; se falhar, o bootloader volta 
+ *  anterior (update.h e boot/boot.h).
+ *   -A altura das tbuas separadas e os tempos de clique e de
+ *  inicializao so parmetros em EEPROM (CMD_SET_PARAM, params.h),
+ *  e no constantes da compilao: uma s imagem serve todas as
+ *  janelas.
  *
  *  Estrutura do cdigo:
  *   Este cdigo, tal como a grande maioria de cdigos
@@ -55,10 +133,33 @@
  *   a persiana. Qualquer comando por porta srie ir forar o
  *   estado a "obedecer" ao comando, independentemente do estado
  *   atual (com exceo do estado de inicializao), sendo assim
- *   que se estabelece a prioridade a estes comandos. As sadas
- *   (motor e sua direo) so controladas no incio de cada estado
- *   com o fim de evitar uma estrutura "switch" separada para o
- *   efeito.
+ *   que se estabelece a prioridade a estes comandos.
+ *   Cada estado  descrito numa tabela em memria de programa
+ *   (states[]): as sadas do motor no estado, as aes de
+ *   entrada e de sada (por exemplo, armar TMR_CLICK ao entrar
+ *   em CLOSE_CHECK/OPEN_CHECK) e a lista de transies, pares
+ *   condio/estado seguinte avaliados por ordem. Em cada passagem
+ *   s so avaliadas as condies do estado atual, e as sadas s
+ *   so escritas quando h uma transio (goto_state()), nunca em
+ *   todas as passagens. Um estado novo  apenas mais uma entrada
+ *   na tabela e meia dzia de condies.
+ *   A lgica (mquina de estados, comandos, calibrao) est em
+ *   controller.c e no acede ao hardware: os mdulos usam as
+ *   funes de hal.h. Este ficheiro contm apenas o que 
+ *   especfico do AVR (configurao dos perifricos, rotinas de
+ *   interrupo e o ciclo principal com sleep), pelo que o mesmo
+ *   controlador corre tambm no computador (sim/), contra um
+ *   modelo da persiana e ficheiros de eventos, com "make check"
+ *   nessa pasta.
+ *   A firmware compila-se com o Makefile da raiz ("make", "make
+ *   size", "make disasm", "make flash"), que tambm gera as
+ *   variantes com LTO/-mrelax para comparao ("make compare") e
+ *   a build de medio das ISR ("make PROFILE=1", ver hal_avr.h)
+ *   e a das latncias do boto e da porta srie at ao motor ("make
+ *   BENCH=1", ver bench.h, com o script bench/latency.py).
+ *   Com o bootloader cada imagem  ligada para o seu slot ("make
+ *   SLOT=A" ou "make SLOT=B", com "make image" para o ficheiro a
+ *   enviar por CMD_FW_BLOCK); o bootloader compila-se com "make boot".
  *
  *  Timer:
  *   Havia alguma liberdade com a escolha da base de tempo para o
@@ -71,64 +172,126 @@
  *   processos),  com uma contagem de 125 (obtido por Excel):
  *    CP * TP * CNT = Fcpu * Tint
  *    1  * 128* 125 = 16M  * 1m
- *   No havendo outras exigncias provenientes do timer, ser
- *   poupado o timer 1, e implementado o timer 2.
- *   Ser implementado o modo normal cujo contador aumenta at
- *   ocorrer overflow, gerando um pedido de interrupo e
- *   reinicializando a 0. Em cada interrupo o contador ser
- *   colocado a 125 contagens do seu valor de overflow, de forma
- *   a perservar as 125 contagens necessrias a interrupes
- *   peridicas de 1 ms. Isto  feito atribuindo diretamente 
- *   varivel do contador o valor referido.
- *   A rotina de interrupo do timer ir decrementar a varivel
- *   "check_delay" at esta atingir 0 (age como temporizador) e
- *   ir aumentar ou reduzir a varivel "height" conforme o motor
+ *   No havendo outras exigncias provenientes do timer, foi
+ *   implementado o timer 2 (no timer 2 o prescaler de 128
+ *   corresponde a CS22:0 = 101, ver clock.c), ficando o timer 1
+ *   livre para o PWM do motor (MOTOR_PWM, ver motor.h) e para a
+ *   build de medio das latncias (BENCH, ver bench.h), que no
+ *   podem ser usados juntos; sem nenhum deles o timer 1  desligado.
+ *    usado o modo CTC, em que o contador aumenta at igualar
+ *   OCR2A (124), gerando um pedido de interrupo e voltando a 0
+ *   no prprio hardware, o que garante exatamente 125 contagens
+ *   por perodo independentemente do atraso no atendimento da
+ *   interrupo (numa verso anterior o contador era recarregado
+ *   na interrupo, em modo normal, o que acumulava deriva).
+ *   Cada interrupo avana tambm um relgio monotnico de 32
+ *   bits (millis()), a base de tempo comum a todo o programa.
+ *   A rotina de interrupo do timer avana os temporizadores por
+ *   software (timer.h: deciso entre clique rpido e lento, tempo
+ *   mximo da inicializao), que s assinalam ao ciclo principal
+ *   que expiraram, e ir aumentar ou reduzir a varivel "height" conforme o motor
  *   esteja a subir ou a descer (se o motor estiver desligado a
- *   varivel permanece inalterada).
+ *   varivel permanece inalterada). O incremento por ms  um valor
+ *   em vrgula fixa pr-calculado para cada sentido (position.h),
+ *   pelo que a interrupo continua a fazer apenas uma soma.
  *
  *  Comunicao srie:
  *   Utilizando um mtodo de comunicao assncrona, torna-se
  *   necessrio definir uma Baudrate, que foi arbitrada como
- *   sendo de 57600. Vai-se utilizar o modo normal de amostragem,
- *   estabelecendo 16 amostras por cada bit recebido. Sendo a
- *   frequncia do cristal associado ao ATMega328p de 16MHz, isto
- *   traduz-se num registo de UBRRO (seguindo frmula da
- *   datasheet):
- *    UBBRO = 16M/(16*57600)-1 = 16.361 (arredondando) = 16
- *    BAUDRATE = 16M/(16*(16-1)) = 58823,52941 bps
- *   Ou seja, um erro de 2,124% que no ser muito significativo
- *   tendo em conta que no sero usados bits de paridade, e
- *   apenas 1 stop bit com 8 bits de dados (9bits no total) que
- *   corresponde a um erro mximo admissvel de cerca de 5,56%.
- *   So ativos os registos de leitura e escrita bem como de
+ *   sendo de 57600. Originalmente usava-se o modo normal de
+ *   amostragem (16 amostras por bit), com o divisor truncado:
+ *    UBBRO = 16M/(16*57600)-1 = 16.361 (truncado) = 16
+ *    BAUDRATE = 16M/(16*(16+1)) = 58823,52941 bps
+ *   Ou seja, um erro de 2,124%, que somado ao erro do adaptador
+ *   USB-srie do computador j falhava com alguns adaptadores.
+ *   Agora a velocidade  escolhida em funcionamento (baud.c): o
+ *   divisor  arredondado e calculado para os dois modos de
+ *   amostragem (normal e U2X, 8 amostras por bit), ficando o de
+ *   menor erro; a 57600  o modo U2X com UBRR0 = 34 (0,8%).
+ *   Pode ser mudada com o comando CMD_SET_BAUD (at 2 Mbps, sem
+ *   erro a 250k/500k/1M), que s fica guardada em EEPROM depois
+ *   de o computador a confirmar (ver baud.h).
+ *   A porta srie  configurada apenas em serial.c (usart_init()),
+ *   com 8 bits de dados, sem paridade e 1 stop bit (8N1), e so
+ *   ativos os registos de leitura e escrita bem como de
  *   interrupo por leitura. Sempre que  lido um valor  gerado
- *   o respetivo pedido de interrupo que simplesmente guarda o
- *   valor recebido numa varivel e devolve-o (a devoluo do valor
- *   apenas serve para questes informativas ao utilizador). Esta
- *   varivel ser avaliada no main() de forma a averiguar se  um
- *   input vlido e qual o comando a que lhe corresponde, de entre
- *   os seguintes:
+ *   o respetivo pedido de interrupo que guarda o valor recebido
+ *   num buffer circular (ring buffer) e devolve-o (a devoluo do
+ *   valor apenas serve para questes informativas ao utilizador).
+ *   O buffer tem um tamanho potncia de 2 (RX_BUF_SIZE) para que o
+ *   avano dos ndices seja apenas uma mscara, e tem um nico
+ *   produtor (a ISR, que s escreve "rx_head") e um nico
+ *   consumidor (o main(), que s escreve "rx_tail"), pelo que no
+ *    preciso desligar interrupes para o usar. Se o buffer
+ *   estiver cheio o caracter  descartado e  incrementado o
+ *   contador "rx_overflow" (lido com "rx_overflows()"). Em cada
+ *   iterao o main() esvazia o buffer de uma s vez, avaliando
+ *   cada caracter de forma a averiguar se  um input vlido e qual
+ *   o comando a que lhe corresponde, de entre os seguintes:
  *    'u'-abrir completamente
  *    'g'-colocar as tbuas separadas sem abrir a persiana
  *    '0'~'9'- abrir at x% (0% corresponde a fechar a persiana)
+ *   Em alternativa aos comandos de um s caracter, o computador
+ *   pode enviar tramas binrias (protocol.c) que comeam por um
+ *   byte que no  ASCII, com nmero de sequncia e CRC, e que
+ *   podem conter vrios comandos, incluindo abrir at uma altura
+ *   absoluta (em ms) ou at uma percentagem com resoluo de 0.1%,
+ *   e consultar o estado atual (CMD_STATUS devolve de uma s vez
+ *   um registo de tamanho fixo com o estado, alturas, tempo desde o
+ *   arranque, contadores de erros e verso, para que um supervisor
+ *   possa consultar muitos ns por segundo). Cada trama tem resposta. Uma trama
+ *   interrompida durante mais de PROTO_TIMEOUT ms  descartada.
+ *   Para ligar vrias persianas  mesma linha (RS-485) cada n tem
+ *   um endereo e uma mscara de grupos guardados em EEPROM (bus.c)
+ *   e pode ser compilado com BUS_MODE a BUS_RS485 ou BUS_MPCM (9
+ *   bits de dados com filtragem dos endereos no hardware). Nestes
+ *   modos no h eco, para no colidir com o computador na linha.
+ *   Os movimentos pedidos a um grupo ou a todos arrancam na janela
+ *   de cada n (BUS_SLOT_TIME ms cada, configurada ou derivada do
+ *   endereo), para que a corrente de arranque de um grupo grande
+ *   no some num s ms; a mesma janela marca a resposta dos ns com
+ *   janela configurada.
+ *
+ *  Horrio e cenas:
+ *   Para que o trfego na linha no cresa com o nmero de
+ *   persianas, cada n guarda em EEPROM um horrio (schedule.c):
+ *   entradas com o minuto do dia, a altura de referncia e o grupo
+ *   a que se destinam. Basta ao computador acertar a hora do dia por
+ *   difuso (CMD_SET_TIME) uma vez por dia; a hora  depois contada
+ *   pelo prprio n a partir do relgio de 1ms, e a cada minuto as
+ *   entradas desse minuto para os grupos do n movem a persiana como
+ *   CMD_GOTO_MS. Cada n guarda tambm a sua altura em cada uma de
+ *   SCENES cenas, ativadas por difuso (CMD_SCENE) ou, ponto-a-ponto,
+ *   por um s byte (SCENE_BYTE+n) fora de qualquer trama.
  *
  *  Debug:
- *   O debug no  da nossa autoria tendo sido utilizado para o
- *   efeito a biblioteca "serial.c" da autoria do docente Joo
- *   Paulo Sousa. Esta biblioteca redireciona a stream stdout
- *   colocando a componente ".put" de FDEV_SETUP_STREAM para a nova
- *   funo "usart_putchar()" que escreve, sempre que possvel, um
- *   caractere da string indicada por "printf()". A flag de
- *   FDEV_SETUP_STREAM  colocada em modo de escrita
- *   ("_FDEV_SETUP_WRITE"). (".get" no ter nenhum valor pois
- *   apenas se pretende escrever para o PC)
- *   A funo "printf_init()" limita-se a atualizar o valor da
- *   varivel stdout para a nova configurao descrita.
- *   Para ativar o modo Debug basta definir a constante DEBUG na
- *   linha de cdigo 143.
- *   O cdigo debug leva muito tempo a correr em relao ao resto
- *   do programa, e  apenas usado aquando do teste da persiana
- *   na fase de desenvolvimento.
+ *   A biblioteca "serial.c" do docente Joo Paulo Sousa, que
+ *   redirecionava a stream stdout para a porta srie para usar
+ *   "printf()", deu origem ao driver da porta srie: cada caracter
+ *    colocado num buffer circular de transmisso, esvaziado pela
+ *   interrupo USART_UDRE_vect, de forma que nem o debug nem o
+ *   eco da receo esperam pelo transmissor (se o buffer estiver
+ *   cheio o caractere  descartado). O debug j no usa
+ *   "printf()", que ocupava vrios KB de flash e demorava a
+ *   interpretar o formato: cada campo  escrito com as funes de
+ *   formato fixo de serial_fmt.c (texto em memria de programa,
+ *   inteiros em decimal e bytes em hexadecimal).
+ *   Para ativar o modo Debug basta definir a constante DEBUG no
+ *   incio de controller.c.
+ *   O cdigo debug  apenas usado aquando do teste da persiana
+ *   na fase de desenvolvimento, mas a sua temporizao fica
+ *   prxima da da verso final.
+ *
+ *  Telemetria:
+ *   Como alternativa ao debug, que pouco interfere com a
+ *   temporizao, o comando CMD_TELEMETRY pede o envio peridico de
+ *   registos binrios de tamanho fixo (telemetry.c) com o instante
+ *   (ms e frao do ms lida do timer 2), o estado, a altura e os
+ *   bits do motor, direo e botes. Opcionalmente s so enviados
+ *   registos quando algo mudou. Cada registo custa apenas a cpia de
+ *   alguns bytes para o buffer de transmisso. S na ligao
+ *   ponto-a-ponto: numa linha RS-485 os ns falam apenas quando
+ *   lhes perguntam.
  *
  *  Cabealho creado em: 26/11/2018 (ps avaliao presencial)
  *  Cdigo creado em: 15/11/2018
@@ -136,296 +299,108 @@
  *               Maria Sara Delgadinho Noronha
  */
 
-#include <avr/interrupt.h>
-#include "serial.h"
-
-// DEBUG mode
-//#define DEBUG
-
-// Nomes simbolicos para os estados
-#define INIT 0 // Inicializao
-#define IDLE 1 // Aguarda Comandos
-#define CLOSE_CHECK 2 // Fecha e decide entre manual e automtico
-#define OPEN_CHECK 3 // Abre e decide entre manual e automtico
-#define OPEN_AUTO 4 // Abre automaticamente
-#define CLOSE_AUTO 5 // Fecha automaticamente
-#define CLOSE_MANUAL 6 // Fecha manualmente
-#define OPEN_MANUAL 7 // Abre manualmente
-#define OPEN_X 8 // Abre/fecha at X% da altura mxima (altura de referncia)
-#define ILLEGAL 255 // Para estados imprevistos
-
-#define T2BOTTOM 255-125 // Valor inicial de contagem de timer 2 (ver funo "config_timer2()")
-
-#define MOTOR PB0 // Posio respetiva ao pino do motor (ativo a 0)
-#define DIR PB1 // Posio respetiva ao pino da direo do motor (0 vai para cima, 1 vai para baixo)
-#define CLOSE PD6 // Posio respetiva ao pino do boto de fecho (ativo a 0)
-#define OPEN PD7 // Posio respetiva ao pino do boto de abertura (ativo a 0)
-
-#define CHECK_TIME 500 // 0.5s para distinguir entre clique rpido e lento
-#define INIT_TIME 14000 // 14s para fechar totalmente (garantidamente)
 
-#define MAX_HEIGHT 13200 //13.2s para chegar  mxima altura (cronometrado - sujeito a erro)
-#define OPEN_TIME 2500 // Corresponde ao tempo que a persiana demora a comear a abrir (tbuas deixam de tocar na base, tambm foi cronometrado)
-#define OPEN_10 (MAX_HEIGHT-OPEN_TIME)/10 // Valor relativo (10%) de abertura descontando o tempo de abertura definido na linha anterior
-
-
-#ifndef F_CPU
-#define F_CPU 16000000ul // 16MHz de frequncia de relgio do processador (para estabelecer a Baudrate)
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include "hal.h"
+#include "controller.h"
+#include "endstop.h"
+#include "update.h"
+#include "bench.h"
+
+uint8_t reset_flags __attribute__((section(".noinit"))); // MCUSR no arranque (causa do ltimo reset)
+
+/* Corre antes de main() e da inicializao das variveis: guarda a
+ * causa do reset e desliga o watchdog, que depois de um reset por
+ * watchdog continua ligado com o prazo mnimo (16ms) e voltaria a
+ * fazer reset antes de chegar a main(). Com o bootloader, que j o
+ * fez, a causa chega em GPIOR1 (com os bits BOOT_FLAG_*) */
+void reset_capture (void) __attribute__((naked, used, section(".init3")));
+void reset_capture (void){
+#if BOOTLOADER
+  reset_flags = GPIOR1;
+#else
+  reset_flags = MCUSR;
 #endif
+  MCUSR = 0;
+  wdt_disable();
+}
 
-#define BAUD 57600ul // Baudrate de 57600 simbolos/s
-#define UBBR_VAL ((F_CPU/(BAUD*16))-1) // 16 amostras por smbolo (modo normal)
+/* Configura pinos de entrada/sada */
+void config_io (void){
+  motor_init(); // configura os pinos respetivos ao motor e sua direo como sadas (motor desligado)
+  hal_buttons_init(); // configura os pinos respetivos aos botes de abertura/fecho como entradas
+#if BUS_MODE != BUS_P2P
+  PORTD &= ~(1<<BUS_DE); // Transcetor RS-485 comea a receber...
+  DDRD |= (1<<BUS_DE); // ...com o pino de driver enable como sada
+#endif
 
-uint8_t OpenBtn = 0; // Varivel auxiliar de verificao (Boto de abertura pressionado -> 1)
-uint8_t CloseBtn = 0; // Varivel auxiliar de verificao (Boto de fecho pressionado -> 1)
-uint8_t RE_OpenBtn = 0; // Rising Edge de OpenBtn
-uint8_t RE_CloseBtn = 0; // Rising Edge de CloseBtn
-volatile uint8_t USB_input = 0; // Varivel auxiliar que vai guardar o caracter recebido por porta srie
-uint8_t state = INIT; // Estado atual
-unsigned int height_reference = 0; // Altura de referncia (apenas pertinente no estado OPEN_X)
-volatile unsigned int height = MAX_HEIGHT; // Altura atual, inicia no topo
-volatile unsigned int check_delay = INIT_TIME; // Tempo de espera na deciso entre clique rpido e lento. Tambm 
-                                               // usado como timer na inicializao para garantir que a persiana fecha
-#ifdef DEBUG
-uint8_t printfstate = 254; // ltimo estado impresso por printf (apenas pertinente no caso de debug)
+  endstop_init(); // Entradas dos fins de curso
+#if POS_SOURCE != POS_TIME
+  hal_pulse_init(POS_QUADRATURE == POS_SOURCE); // Entradas e interrupo do sensor de posio
 #endif
+  hal_profile_init(); // Pinos de medio das ISR (s na build PROFILE)
 
-/* Configura pinos de entrada/sada */
-void config_io (void){
-  DDRB |= ((1<<MOTOR) | (1<<DIR)); // configura os pinos respetivos ao motor e sua direo como sadas
-  DDRD &= (~(1<<CLOSE) & ~(1<<OPEN)); // configura os pinos respetivos aos botes de abertura/fecho como entradas
+  PCMSK2 |= (1<<CLOSE) | (1<<OPEN); // Mudana nos pinos dos botes (PCINT22/23, mesma posio que no porto D)...
+  PCICR |= (1<<PCIE2); // ...gera interrupo, para acordar o CPU
 
-  PORTB |= (1<<MOTOR); // Garante que o motor est, inicialmente, desligado
+  ACSR |= (1<<ACD); // Desliga o comparador analgico
+  PRR = (1<<PRTWI) | (1<<PRSPI) | (CURRENT_SENSE ? 0 : (1<<PRADC)) | (1<<PRTIM0) | ((MOTOR_PWM || BENCH) ? 0 : (1<<PRTIM1)); // e os perifricos que no so usados (o ADC s com CURRENT_SENSE, o timer 1 s com MOTOR_PWM ou na build de medio)
+  set_sleep_mode(SLEEP_MODE_IDLE); // Timer 2 e porta srie continuam a funcionar enquanto o CPU dorme
 }
 
-/* Configura timer 2 para contar em ciclos de 1ms:
- * Frequncia do CPU = 16MHz;
- * TP = 128; CP = 1; CNT = 125 impulsos (255-130);
- * onde 130  o valor inicial de contagem para que
- * sejam contados 125 impulsos at overflow.
- * Tempo entre interrupes  dado por:
- *   128*125/16M = 1ms */
-void config_timer2 (void){
-  TCCR2B = 0; // Para o timer
-  TIFR2 |= (7<<TOV2); // Desliga quaisquer flags que estejam ativas
-  TCCR2A = 0; // Modo de contagem normal
-  TCNT2 = T2BOTTOM; // Posiciona o inicio da contagem no valor estabelecido em T2BOTTOM
-  TIMSK2 = (1<<TOIE1); // Permite interrupo por overflow
-  TCCR2B = 5; // Inicia o timer com um prescaler : TP=128
+ISR (PCINT2_vect){ // Um dos botes mudou (tambm acorda o CPU)
+  btn_div = 1; // Amostra os botes j no prximo ms, em vez de esperar pelo resto do perodo de amostragem
 }
 
-void init_usart(){
-	// Configurao do conjunto de bits para determinar frequncia de transio entre bits
-	UBRR0 = UBBR_VAL;
-	/* Significa que cada bit ser amostrado 16 vezes
-	 * Que por sua vez significa que teremos uma
-	 * Baudrate efetiva de 58823.52941 Bps */
-
-	UCSR0C = (3<<UCSZ00) // Cada segmento ter 8 bits de informao til (data bits),
-		   | (0<<UPM00)  // sem paridade,
-		   | (0<<USBS0); // e 1 bit de paragem
-
-	UCSR0B = (1<<TXEN0) | (1<<RXEN0) | (1<<RXCIE0); // Permite leitura, escrita e interrupo aps leitura
+ISR (TIMER2_COMPA_vect){ // Interrupo gerada a cada 1ms (o timer volta a 0 sozinho, modo CTC)
+  PROFILE_ENTER(PROFILE_TICK);
+  controller_tick(); // relgio, botes, posio, motor e temporizadores
+  PROFILE_EXIT(PROFILE_TICK);
 }
 
-ISR (USART_RX_vect) { // Sempre que recebe dados por porta srie
- USB_input = UDR0; // ATMega recebe os dados do PC e guarda-os
- UDR0 = USB_input; // Envia os dados que recebeu, de volta para o PC
+#if POS_SOURCE != POS_TIME
+ISR (INT1_vect){ // Impulso do sensor de posio (flanco ascendente do canal A)
+  position_pulse(hal_pulse_b()); // avana ou recua a altura (position.h)
 }
+#endif
 
-ISR (TIMER2_OVF_vect){ // Interrupo gerada a cada 1ms
-  TCNT2 = T2BOTTOM; // atualiza valor inicial de contagem do timer 2
-
-  if ( !(PINB & (1<<MOTOR)) && !(PINB & (1<<DIR)) && (height)){ // se o motor estiver a fechar
-    height--; // decrementa altura
-  }
-  else if ( !(PINB & (1<<MOTOR)) && (PINB & (1<<DIR)) && (height < MAX_HEIGHT)){ // se o motor estiver a abrir
-    height++; // incrementa altura
-  }
+#if CURRENT_SENSE
+ISR (ADC_vect){ // Nova converso do ADC (free-running, s com o motor ligado)
+  current_sample(hal_adc_read()); // soma e filtra a corrente do motor (current.h)
+}
+#endif
 
-  if (check_delay){ // se check_delay ainda no atingiu 0
-    check_delay--; // decrementa
+/* Adormece o CPU at  prxima interrupo, a no ser que j haja
+ * caracteres recebidos por processar */
+void sleep_until_event (void){
+  cli(); // Verificao e adormecimento no podem ser separados por uma interrupo
+  if (!rx_pending()){
+    sleep_enable();
+    sei(); // A instruo seguinte a sei()  sempre executada antes de qualquer interrupo
+    sleep_cpu(); // por isso uma interrupo nunca fica  espera da seguinte para acordar o CPU
+    sleep_disable();
   }
+  sei();
 }
 
 
 
 int main(){
 
-  init_usart(); // Configura a comunicao por porta srie
-  config_io(); // Configura pinos de entrada e sada
+  config_io(); // Configura pinos de entrada e sada (antes da porta srie, que l os botes na recuperao da velocidade)
+  usart_init(); // Configura a comunicao por porta srie (serial.c)
   config_timer2(); // Configura timer 2
+  supervisor_init((BOOTLOADER && (reset_flags & (1<<BOOT_FLAG_REVERTED))) ? FAULT_ROLLBACK : (reset_flags & (1<<WDRF)) ? FAULT_WATCHDOG : (reset_flags & (1<<BORF)) ? FAULT_BROWNOUT : FAULT_NONE); // Regista a causa do reset e liga o watchdog
+  controller_init(); // L a configurao da EEPROM e escolhe o estado inicial
+  bench_init(); // Timer 1 da medio das latncias (s na build BENCH)
   sei(); // Ativar bit geral de interrupes, permitindo interrupes em geral
 
-  #ifdef DEBUG
-    printf_init();
-    printf("\n____________________|DEBUG ON|____________________\n");
-  #endif
-
-
   while(1){ // Ciclo infinito (Loop)
-
-    // Leitura de entradas no mesmo instante
-    RE_CloseBtn = (!(PIND & (1<<CLOSE))) && (!CloseBtn); // Ativo no flanco ascendente do botao de abertura
-    CloseBtn = !(PIND & (1<<CLOSE)); // Botao de fecho (ativo a 1)
-    RE_OpenBtn = (!(PIND & (1<<OPEN))) && (!OpenBtn); // Ativo no flanco ascentende do botao de abertura
-    OpenBtn = !(PIND & (1<<OPEN)); // Botao de abertura (ativo a 1)
-
-    /* A porta srie tem prioridade sobre os butes, portanto assim que algo  lido, 
-     * processado o que foi recebido e a mquina de estados  forada ao estado adequado */
-    if(USB_input!=0){ // Se algo foi lido por porta srie fora a mquina de estados a responder de acordo
-      if (INIT!=state){
-        if ('u' == USB_input){ // Se se premiu "u", abre completamente
-          state = OPEN_AUTO; // Abre (completamente) em modo automtico
-        }
-        else if ('0' == USB_input) { // Se se premiu "0", fecha completamente
-          state = CLOSE_AUTO; // Fecha (completamente) em modo automtico
-        }
-        else if (USB_input>'0' && USB_input<='9'){ // Foi premido um nmero que no zero
-          height_reference = OPEN_10*(USB_input-48)+OPEN_TIME; // Toma valores desde 10% a 90% de abertura, dependendo da tecla premida
-          state = OPEN_X; // Abre/fecha at height_reference
-        }
-        else if (USB_input == 'g'){ // Se se premiu "g", separa as tbuas sem abrir a persiana
-          height_reference = OPEN_TIME; // Altura de abertura efetiva da persiana
-          state = OPEN_X; // Abre/fecha at ficar com as tbuas separadas
-        }
-      }
-
-      USB_input = 0; // Reset da varivel de leitura
+    bench_poll(); // Prximo pedido da medio das latncias (s na build BENCH)
+    if (!controller_poll()){ // Se o estado mudou, as transies do novo estado so avaliadas j na prxima passagem
+      sleep_until_event(); // seno dorme at  prxima interrupo
     }
-
-    switch (state){
-      case INIT: // 0 - Inicializao (fecha totalmente a persiana e ignora comandos do utilizador)
-        PORTB &= ~(1<<MOTOR); // Liga motor
-        PORTB |= (1<<DIR); // com direo para cima (abre)
-
-        if (!check_delay){ // Se j passou tempo de inicializao (check_delay  usado como timer de inicializao apenas nesta linha)
-          state = IDLE; // para de fechar e aguarda comandos do utilizador
-        }break;
-
-      case IDLE: // 1 - Espera por qualquer ao (Inativo)
-        PORTB |= (1<<MOTOR); // desliga motor
-
-        if (RE_CloseBtn && height ){ // Quer-se fechar e ainda no est fechado nem se est a carregar no boto de abrir
-          state = CLOSE_CHECK; // Fecha persiana e...
-          check_delay = CHECK_TIME; //...inicializa contagem do tempo que se mantm o boto carregado
-        }
-        else if (RE_OpenBtn && (MAX_HEIGHT != height) ){ // Quer-se abrir e ainda no est aberto
-          state = OPEN_CHECK; // Abre persiana e...
-          check_delay = CHECK_TIME; // ...inicializa contagem do tempo que se mantm o boto carregado
-        }break;
-
-
-      case CLOSE_CHECK: // 2 - Fecha e verifica quanto tempo se prime o boto
-        PORTB &= ~(1<<MOTOR); // Liga motor
-        PORTB &= ~(1<<DIR); // com direo para baixo (fecha)
-
-    	if (!height){ // Se j fechou completamente
-    	  state = IDLE; // para de fechar
-    	}
-        else if (!CloseBtn){ // Se j no se est a carrergar no boto (implica que foi um clique rpido)
-          state = CLOSE_AUTO; // fecha em modo automtico
-        }
-        else if (!check_delay){ // Se j passou o tempo (implica que foi um clique lento)
-          state = CLOSE_MANUAL; // fecha em modo manual
-        }
-        else if (OpenBtn) { // Se se carregar no boto de abertura
-          state = IDLE; // Para de fechar
-        }break;
-
-
-      case OPEN_CHECK: // 3 - Abre e verifica quanto tempo se prime o boto
-        PORTB &= (~(1<<MOTOR)); // Liga motor
-        PORTB |= (1<<DIR); // com direo para cima (abre)
-
-        if (MAX_HEIGHT == height){ // Se j abriu completamente
-          state = IDLE; // para de abrir
-        }
-        else if (!OpenBtn){ // Se j no se est a carrergar no boto (implica que foi um clique rpido)
-          state = OPEN_AUTO; // abre em modo automtico
-        }
-        else if (!check_delay){ // Se j passou o tempo (implica que foi um clique lento)
-          state = OPEN_MANUAL; // abre em modo manual
-        }
-        else if (CloseBtn){ // Se se carregar no boto de fecho
-          state = IDLE; // Para de abrir
-        }break;
-
-
-      case OPEN_AUTO: // 4 - Abre at a persiana ficar completamente aberta
-        PORTB &= (~(1<<MOTOR)); // Liga motor
-        PORTB |= (1<<DIR); // com direo para cima (abre)
-
-        if (MAX_HEIGHT == height || OpenBtn){ // Se j abriu completamente ou voltou-se a carregar no boto de abrir
-          state = IDLE; // para de abrir
-        }
-        else if(CloseBtn){ // Se se carregou no boto de fecho
-          state = CLOSE_CHECK; // Fecha persiana e...
-          check_delay = CHECK_TIME; //...inicializa contagem do tempo que se mantm o boto carregado
-        }break;
-
-
-      case CLOSE_AUTO: // 5 - Fecha at a persiana ficar completamente fechada
-        PORTB &= ~(1<<MOTOR); // Liga motor
-        PORTB &= ~(1<<DIR); // com direo para baixo (fecha)
-
-        if ( (!height) || CloseBtn){ // Se j fechou completamente ou voltou-se a carregar no boto de fechar
-          state = IDLE; // para de fechar
-        }
-        else if (OpenBtn){ // Se carregar no boto de abrir posteriormente a persiana volta a abrir
-          state = OPEN_CHECK; // Abre persiana e...
-          check_delay = CHECK_TIME; // ...inicializa contagem do tempo que se mantm o boto carregado
-        }break;
-
-
-      case CLOSE_MANUAL: // 6 - Fecha persiana at deixar de premir o boto (ou fechar completamente)
-        PORTB &= ~(1<<MOTOR); // Liga motor
-        PORTB &= ~(1<<DIR); // com direo para baixo (fecha)
-
-        if (!CloseBtn || !height || OpenBtn){ // Se j fechou ou se deixou de carregar no boto ou se carregou no boto de abertura
-          state = IDLE; // para de fechar
-        }break;
-
-
-
-      case OPEN_MANUAL: // 7 - Abre persiana at deixar de premir o boto (ou abrir completamente)
-        PORTB &= (~(1<<MOTOR)); // Ligar motor
-        PORTB |= (1<<DIR); // com direo para cima (abre)
-
-        if (!OpenBtn || (MAX_HEIGHT == height) || CloseBtn){ // Se j abriu ou se deixou de carregar no boto ou se carregou no boto de fecho
-          state = IDLE; // para de abrir
-        }break;
-
-
-      case OPEN_X: // 8 - Abre/fecha at X% da altura (height_reference)
-	    if (height > (height_reference)){ // Se a altura atual est acima da altura de referncia
-          PORTB &= ~(1<<MOTOR); // Liga motor
-          PORTB &= ~(1<<DIR); // com direo para baixo (fecha)
-        }
-        else if (height < (height_reference)){ // Se a altura atual est abaixo da altura de referncia
-          PORTB &= (~(1<<MOTOR)); // Liga motor
-          PORTB |= (1<<DIR); // com direo para cima (abre)
-        }
-        else if (height == (height_reference)){ // Se a altura de referncia foi atingida
-          state = IDLE; // Para de abrir/fechar
-        }break;
-
-
-      case ILLEGAL:// em casos ilegais o motor  desligado e o sistema entra em bloqueio permanentemente
-        PORTB |= (1<<MOTOR); // desliga motor
-        break;
-
-      default:// para qualquer caso fora do previsto, transita para o estado ilegal e desliga motor
-        PORTB |= (1<<MOTOR); // desliga motor
-        state = ILLEGAL; // transita para estado ilegal
-    }
-
-    #ifdef DEBUG
-      if (state != printfstate){
-        printf("((STATE:%d; height:%d; Input:%c; check_delay:%u; OPEN:%d  CLOSE:%d  MOTOR:%d  DIR %d))\n",state, height, USB_input, check_delay, OpenBtn ,CloseBtn ,!(PINB & (1<<MOTOR)) ,(PINB & (1<<DIR)));
-        printfstate = state;
-      }
-    #endif
-
   }
 }
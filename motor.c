@@ -0,0 +1,35 @@
+/*
+ * motor.c
+ *  Sadas do motor e da direo, com tempo morto nas inverses de
+ *  sentido (ver motor.h)
+ */
+
+#include "motor.h"
+
+volatile uint8_t motor_target = OUT_OFF;
+volatile uint16_t motor_dead = 0;
+volatile uint8_t motor_settle = 0;
+volatile uint16_t motor_hold = 0;
+volatile uint16_t motor_ramp = 0;
+
+/* Configura os pinos do motor e da direo como sadas, com o motor desligado */
+void motor_init (void){
+  hal_motor_init(); // (pinos MOTOR e DIR, ver hal_avr.h)
+}
+
+/* Pede novas sadas (OUT_*). Parar e arrancar no sentido atual 
+ * imediato; uma inverso fica pendente at o escalonador a concluir */
+void motor_request (uint8_t outputs){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // A ISR tambm mexe nas sadas
+    motor_target = outputs;
+    motor_update();
+  }
+}
+
+/* Adia o prximo arranque do motor "ms" ms (0 arranca logo). Deve
+ * ser chamada antes do pedido das sadas que liga o motor */
+void motor_stagger (uint16_t ms){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // Valor de 16 bits tambm usado pela ISR
+    motor_hold = ms;
+  }
+}
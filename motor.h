@@ -0,0 +1,181 @@
+/*
+ * motor.h
+ *  Sadas do motor e da direo, com tempo morto nas inverses de
+ *  sentido
+ *
+ *  O programa nunca escreve diretamente nos pinos do motor: pede
+ *  umas sadas (motor_request()) e o escalonador, chamado a cada ms
+ *  pela ISR do timer 2, leva-as at l em segurana. Parar e arrancar
+ *  no sentido em que o rel da direo j est  imediato. Inverter
+ *  o sentido  feito em trs passos:
+ *   1. desliga o motor;
+ *   2. espera MOTOR_DEAD_TIME ms (e que a persiana acabe de deslizar,
+ *      ver position.h) antes de mudar a direo;
+ *   3. espera MOTOR_SETTLE_TIME ms para o rel da direo comutar e
+ *      s ento volta a ligar o motor.
+ *  O pedido fica guardado durante a espera, pelo que uma inverso
+ *  custa apenas algumas centenas de ms de atraso, e um novo pedido a
+ *  meio (por exemplo parar) substitui o anterior.
+ *  motor_stagger() adia tambm o prximo arranque (mas no parar nem
+ *  mudar a direo), para que os motores de um grupo arranquem cada
+ *  um na sua janela (ver bus.h).
+ *
+ *  Com MOTOR_PWM a 1 (e um driver de MOSFET em vez de um rel no
+ *  pino do motor, ver hal_avr.h) o motor  comandado em PWM pelo
+ *  timer 1: arranca a MOTOR_DUTY_MIN e acelera at 100% em
+ *  MOTOR_RAMP_UP ms; para parar (ou inverter) abranda at
+ *  MOTOR_DUTY_MIN em MOTOR_RAMP_DOWN ms e s ento desliga, sempre
+ *  com a mesma desacelerao, pelo que a distncia de paragem 
+ *  repetvel (somada  que a persiana desliza em pos_stop_up/down).
+ *  A rampa avana em vrgula fixa Q8.8 na ISR do timer 2, e a altura
+ *  estimada avana em cada ms proporcionalmente ao duty cycle
+ *  (position_tick()). Num fim de curso, ou com motor_halt(), o motor
+ *  desliga logo, sem rampa.
+ */
+
+#ifndef MOTOR_H_
+#define MOTOR_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "position.h"
+#include "endstop.h"
+
+#ifndef MOTOR_DEAD_TIME
+#define MOTOR_DEAD_TIME 300 // ms de motor desligado antes de mudar a direo
+#endif
+#ifndef MOTOR_SETTLE_TIME
+#define MOTOR_SETTLE_TIME 20 // ms entre mudar a direo e voltar a ligar o motor (comutao do rel)
+#endif
+
+#if MOTOR_SETTLE_TIME > 255
+#error "MOTOR_SETTLE_TIME tem de ser no mximo 255ms"
+#endif
+
+#ifndef MOTOR_PWM
+#define MOTOR_PWM 0 // Motor ligado/desligado, sem PWM
+#endif
+#define MOTOR_DUTY_MAX 255 // Duty cycle a 100%
+#ifndef MOTOR_DUTY_MIN
+#define MOTOR_DUTY_MIN 80 // Duty cycle de arranque e de paragem (abaixo dele o motor no roda)
+#endif
+#ifndef MOTOR_RAMP_UP
+#define MOTOR_RAMP_UP 250 // ms de MOTOR_DUTY_MIN at 100%
+#endif
+#ifndef MOTOR_RAMP_DOWN
+#define MOTOR_RAMP_DOWN 150 // ms de 100% at MOTOR_DUTY_MIN
+#endif
+
+#if MOTOR_DUTY_MIN < 1 || MOTOR_DUTY_MIN >= MOTOR_DUTY_MAX || MOTOR_RAMP_UP < 1 || MOTOR_RAMP_DOWN < 1
+#error "MOTOR_DUTY_MIN tem de estar entre 1 e 254 e as rampas durar pelo menos 1ms"
+#endif
+
+#define MOTOR_RAMP_UP_STEP (((uint16_t)(MOTOR_DUTY_MAX - MOTOR_DUTY_MIN) << 8) / MOTOR_RAMP_UP) // Acelerao por ms (Q8.8)
+#define MOTOR_RAMP_DOWN_STEP (((uint16_t)(MOTOR_DUTY_MAX - MOTOR_DUTY_MIN) << 8) / MOTOR_RAMP_DOWN) // Desacelerao por ms (Q8.8)
+#define MOTOR_STOP_TIME ((uint32_t)MOTOR_RAMP_DOWN * (MOTOR_DUTY_MAX + MOTOR_DUTY_MIN) / (2 * MOTOR_DUTY_MAX)) // ms a 100% equivalentes  rampa de paragem
+
+// Sadas pedidas ao escalonador
+#define OUT_OFF 0 // Motor desligado
+#define OUT_UP 1 // Motor ligado, com direo para cima (abre)
+#define OUT_DOWN 2 // Motor ligado, com direo para baixo (fecha)
+
+extern volatile uint8_t motor_target; // Sadas pedidas (OUT_*)
+extern volatile uint16_t motor_dead; // ms que ainda faltam do tempo morto
+extern volatile uint8_t motor_settle; // ms que ainda faltam para o rel da direo comutar
+extern volatile uint16_t motor_hold; // ms que ainda faltam at o motor poder arrancar (arranque escalonado)
+extern volatile uint16_t motor_ramp; // Duty cycle atual em Q8.8 (apenas com MOTOR_PWM)
+
+void motor_init(void);
+void motor_request(uint8_t outputs);
+void motor_stagger(uint16_t ms);
+
+/* O motor est ligado */
+static inline uint8_t motor_on (void){
+  return hal_motor_on();
+}
+
+/* Nvel do motor: 0 desligado, MOTOR_DUTY_MAX a 100% (sem PWM, ligado) */
+static inline uint8_t motor_level (void){
+  if (!hal_motor_on()){
+    return 0;
+  }
+  return MOTOR_PWM ? motor_ramp >> 8 : MOTOR_DUTY_MAX;
+}
+
+/* D o prximo passo em direo s sadas pedidas (chamada com as
+ * interrupes desligadas) */
+static inline void motor_update (void){
+  uint8_t up = (OUT_UP == motor_target);
+
+  if (OUT_OFF == motor_target || hal_dir_up() != up){ // Tem de parar (ou de inverter o sentido)
+    if (motor_on()){
+      if (MOTOR_PWM && motor_ramp > ((uint16_t)MOTOR_DUTY_MIN << 8)){ // Ainda a abrandar (ver motor_ramp_tick())
+        return;
+      }
+      hal_motor_set(0); // desliga motor
+      motor_dead = MOTOR_DEAD_TIME; // e comea o tempo morto
+    }
+    if (OUT_OFF == motor_target || motor_dead || pos_coast){ // Parado, ou ainda a deslizar
+      return;
+    }
+    hal_dir_set(up); // Muda a direo com o motor desligado...
+    motor_settle = MOTOR_SETTLE_TIME; // ...e espera pelo rel
+    return;
+  }
+
+  if (!motor_on() && !motor_settle && !motor_hold){ // A direo est certa e estvel (e chegou a janela deste n)
+    if (MOTOR_PWM){ // Arranca devagar
+      motor_ramp = (uint16_t)MOTOR_DUTY_MIN << 8;
+      hal_motor_duty(MOTOR_DUTY_MIN);
+    }
+    hal_motor_set(1); // Liga motor
+  }
+}
+
+/* Avana a rampa do PWM 1ms: acelera at 100% enquanto o motor anda
+ * no sentido pedido, seno abranda (ou para logo, num fim de curso) */
+static inline void motor_ramp_tick (void){
+  uint8_t up = hal_dir_up();
+
+  if (!motor_on()){
+    return;
+  }
+  if ((OUT_UP == motor_target && up) || (OUT_DOWN == motor_target && !up)){
+    motor_ramp = (motor_ramp < ((uint16_t)MOTOR_DUTY_MAX << 8) - MOTOR_RAMP_UP_STEP) ? motor_ramp + MOTOR_RAMP_UP_STEP : (uint16_t)MOTOR_DUTY_MAX << 8;
+  }
+  else if (up ? endstop_top() : endstop_bottom()){ // Est no limite: no empurra contra ele
+    motor_ramp = 0;
+  }
+  else {
+    motor_ramp = (motor_ramp > MOTOR_RAMP_DOWN_STEP) ? motor_ramp - MOTOR_RAMP_DOWN_STEP : 0;
+  }
+  hal_motor_duty(motor_ramp >> 8);
+}
+
+/* Desliga o motor e esquece o pedido (chamada com as interrupes
+ * desligadas, pelo supervisor quando o movimento excede o tempo mximo) */
+static inline void motor_halt (void){
+  motor_target = OUT_OFF;
+  motor_ramp = 0; // (sem rampa)
+  motor_update();
+}
+
+/* Escalonador das sadas (s deve ser chamada pela ISR do timer 2, a cada ms,
+ * depois de position_tick()) */
+static inline void motor_tick (void){
+  if (motor_dead){
+    motor_dead--;
+  }
+  if (motor_settle){
+    motor_settle--;
+  }
+  if (motor_hold){
+    motor_hold--;
+  }
+  if (MOTOR_PWM){
+    motor_ramp_tick();
+  }
+  motor_update();
+}
+
+#endif /* MOTOR_H_ */
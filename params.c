@@ -0,0 +1,110 @@
+/*
+ * params.c
+ *  Parmetros da persiana alterveis em funcionamento (ver params.h)
+ */
+
+#include "params.h"
+#include "position.h"
+
+typedef struct {
+  uint16_t value[PARAMS]; // Valores guardados
+  uint8_t crc; // CRC-8 dos valores
+} param_block_t;
+
+_Static_assert(sizeof(param_block_t) <= PARAM_EE_SIZE, "O bloco dos parmetros no cabe em PARAM_EE_SIZE");
+
+static param_block_t store; // Bloco a escrever na EEPROM
+static uint8_t store_next = sizeof(param_block_t); // Prximo byte de "store" a escrever (sizeof: nenhum)
+
+static const param_desc_t params_table[PARAMS] PROGMEM = {
+  [PARAM_MAX_HEIGHT] = {MAX_HEIGHT, MAX_HEIGHT, MAX_HEIGHT},
+  [PARAM_OPEN_TIME] = {0, MAX_HEIGHT - 1000, 2500}, // (cronometrado; tem de sobrar algum percurso para 10%~90%)
+  [PARAM_CHECK_TIME] = {100, 3000, 500},
+  [PARAM_INIT_TIME] = {POS_TRAVEL_MIN, POS_TRAVEL_MAX, 14000}, // (14s para abrir totalmente)
+};
+
+uint16_t param[PARAMS];
+uint16_t param_open_10;
+
+/* CRC de um bloco de parmetros */
+static uint8_t block_crc (const param_block_t *block){
+  const uint8_t *p = (const uint8_t *)block->value;
+  uint8_t crc = 0x5A; // Valor inicial diferente de 0 para que zeros no sejam vlidos
+  uint8_t i;
+
+  for (i = 0; i < sizeof(block->value); i++){
+    crc = _crc8_ccitt_update(crc, p[i]);
+  }
+  return crc;
+}
+
+/* Limites e valor original de um parmetro */
+void param_limits (uint8_t id, param_desc_t *desc){
+  desc->min = pgm_read_word(&params_table[id].min);
+  desc->max = pgm_read_word(&params_table[id].max);
+  desc->value = pgm_read_word(&params_table[id].value);
+}
+
+/* Calcula os valores derivados (as divises ficam fora dos comandos) */
+static void apply (void){
+  param_open_10 = (MAX_HEIGHT - param[PARAM_OPEN_TIME]) / 10;
+}
+
+/* L os parmetros da EEPROM */
+void params_init (void){
+  param_block_t block;
+  param_desc_t desc;
+  uint8_t valid;
+  uint8_t i;
+
+  eeprom_read_block(&block, hal_eeprom_fixed(PARAM_EE_ADDR), sizeof(block)); // (apagada -> valores originais)
+  valid = block.crc == block_crc(&block);
+  for (i = 0; i < PARAMS; i++){
+    param_limits(i, &desc);
+    param[i] = (valid && block.value[i] >= desc.min && block.value[i] <= desc.max) ? block.value[i] : desc.value;
+  }
+  apply();
+}
+
+/* Altera um parmetro (guardado em EEPROM por params_poll()).
+ * Devolve 0 se no existir ou o valor estiver fora dos limites */
+uint8_t param_set (uint8_t id, uint16_t value){
+  param_desc_t desc;
+  uint8_t i;
+
+  if (id >= PARAMS){
+    return 0;
+  }
+  param_limits(id, &desc);
+  if (value < desc.min || value > desc.max){
+    return 0;
+  }
+  param[id] = value;
+  apply();
+
+  for (i = 0; i < PARAMS; i++){ // (uma escrita a meio recomea: o CRC ainda no foi escrito)
+    store.value[i] = param[i];
+  }
+  store.crc = block_crc(&store);
+  store_next = 0;
+  return 1;
+}
+
+/* Escreve o prximo byte do bloco que mudou, se a EEPROM estiver livre
+ * (chamada no ciclo principal) */
+void params_poll (void){
+  uint8_t *ee = hal_eeprom_fixed(PARAM_EE_ADDR);
+  const uint8_t *p = (const uint8_t *)&store;
+
+  if (!eeprom_is_ready()){
+    return;
+  }
+  while (store_next < sizeof(store)){
+    uint8_t i = store_next++;
+
+    if (eeprom_read_byte(&ee[i]) != p[i]){ // (s escreve os bytes que mudaram)
+      eeprom_write_byte(&ee[i], p[i]);
+      return;
+    }
+  }
+}
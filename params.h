@@ -0,0 +1,62 @@
+/*
+ * params.h
+ *  Parmetros da persiana alterveis em funcionamento (CMD_GET_PARAM
+ *  e CMD_SET_PARAM), para que a mesma firmware sirva todas as janelas
+ *
+ *  Cada parmetro tem um valor de 16 bits, com limites e valor
+ *  original descritos numa tabela em memria de programa
+ *  (params.c). Os valores so guardados em EEPROM num s bloco com
+ *  CRC e copiados para RAM no arranque, pelo que ler um parmetro 
+ *  apenas ler uma varivel; um bloco apagado ou corrompido d lugar
+ *  aos valores originais, e um valor fora dos limites ao original
+ *  desse parmetro. Os valores derivados (param_open_10) so
+ *  calculados sempre que um parmetro muda, para que os comandos que
+ *  os usam nunca dividam.
+ *  Um parmetro alterado passa a valer de imediato; o bloco  escrito
+ *  na EEPROM byte a byte por params_poll(), s quando esta est livre
+ *  (cerca de 3.4ms por byte), para nunca bloquear o ciclo principal,
+ *  e o CRC  o ltimo byte escrito. O bloco est num endereo fixo
+ *  (PARAM_EE_ADDR, antes do registo de arranque), que no depende da
+ *  ordem em que o linker coloca as variveis EEMEM dos mdulos.
+ *
+ *  A altura mxima (PARAM_MAX_HEIGHT)  a unidade das alturas (ver
+ *  position.h) e no depende da janela: o tamanho de cada janela j
+ *   dado pelos tempos de percurso do modelo (CMD_SET_MODEL ou
+ *  CMD_CALIBRATE). Pode ser lida, mas no alterada (limites iguais).
+ */
+
+#ifndef PARAMS_H_
+#define PARAMS_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+// Parmetros (ndice na tabela)
+#define PARAM_MAX_HEIGHT 0 // Altura mxima, em ms de subida (MAX_HEIGHT, s de leitura)
+#define PARAM_OPEN_TIME 1 // Altura a que as tbuas deixam de tocar na base ('g', 10%~90% descontam-na)
+#define PARAM_CHECK_TIME 2 // ms para distinguir entre clique rpido e lento
+#define PARAM_INIT_TIME 3 // ms da inicializao com a persiana por calibrar (garantidamente aberta)
+#define PARAMS 4 // Nmero de parmetros
+
+#define PARAM_EE_ADDR 0x3E0 // Endereo do bloco dos parmetros na EEPROM (o Makefile verifica que as variveis EEMEM acabam antes)
+#define PARAM_EE_SIZE 16 // Bytes reservados para o bloco
+
+#if PARAM_EE_ADDR + PARAM_EE_SIZE > BOOT_RECORD_ADDR
+#error "O bloco dos parmetros sobrepe-se ao registo de arranque"
+#endif
+
+typedef struct {
+  uint16_t min; // Valor mnimo aceite
+  uint16_t max; // Valor mximo aceite
+  uint16_t value; // Valor original (EEPROM apagada)
+} param_desc_t;
+
+extern uint16_t param[PARAMS]; // Valores atuais
+extern uint16_t param_open_10; // 10% da abertura efetiva: (MAX_HEIGHT - OPEN_TIME) / 10
+
+void params_init(void);
+uint8_t param_set(uint8_t id, uint16_t value);
+void params_poll(void);
+void param_limits(uint8_t id, param_desc_t *desc);
+
+#endif /* PARAMS_H_ */
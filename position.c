@@ -0,0 +1,225 @@
+/*
+ * position.c
+ *  Estimativa da posio da persiana a partir do tempo de motor
+ *  ligado, com velocidades de subida e descida diferentes
+ *
+ *  Os parmetros do modelo (tempos de percurso e atrasos de arranque
+ *  em cada sentido e tempo a deslizar depois de parar) so guardados
+ *  em EEPROM. Uma EEPROM apagada ou com valores fora dos limites d
+ *  lugar aos valores originais: MAX_HEIGHT ms nos dois sentidos, sem
+ *  atraso de arranque e sem deslizar, o que reproduz o comportamento
+ *  de 1 unidade de altura por ms.
+ *
+ *  Altura guardada em EEPROM:
+ *   A altura  guardada num de POS_SLOTS registos de 4 bytes (nmero
+ *   de sequncia, altura e CRC), usados rotativamente para distribuir
+ *   o desgaste das clulas. Quando a persiana para  escrito o
+ *   registo seguinte com o nmero de sequncia seguinte; o registo
+ *   mais recente  o que no  seguido por um registo com o nmero
+ *   de sequncia seguinte. Assim que o motor volta a ligar o registo
+ *   mais recente  invalidado (alterando apenas o byte do CRC), pelo
+ *   que um corte de energia a meio de um movimento, ou a meio de uma
+ *   escrita (com o brown-out detector ativo, para que o CPU pare antes
+ *   de a EEPROM deixar de funcionar), deixa sempre a EEPROM sem
+ *   altura vlida e obriga a nova inicializao.
+ *   As escritas so feitas byte a byte por position_poll(), apenas
+ *   quando a EEPROM est livre, para nunca bloquear o ciclo principal
+ *   (cada byte demora cerca de 3.4ms a escrever).
+ */
+
+#include "position.h"
+#include "motor.h"
+
+static position_params_t EEMEM ee_pos_params = {MAX_HEIGHT, MAX_HEIGHT, 0, 0, 0}; // Parmetros guardados em EEPROM
+
+typedef struct {
+  uint8_t seq; // Nmero de sequncia
+  uint8_t height_lo; // Altura (byte menos significativo)
+  uint8_t height_hi; // Altura (byte mais significativo)
+  uint8_t crc; // CRC-8 dos bytes anteriores (errado se o registo foi invalidado)
+} position_slot_t;
+
+static position_slot_t EEMEM ee_pos_slots[POS_SLOTS]; // Registos da altura guardada
+
+#define STORE_QUEUE 8 // Escritas pendentes na EEPROM (potncia de 2)
+
+static uint8_t *store_addr[STORE_QUEUE]; // Endereos das escritas pendentes
+static uint8_t store_value[STORE_QUEUE]; // Valores das escritas pendentes
+static uint8_t store_head = 0; // Prxima escrita a acrescentar
+static uint8_t store_tail = 0; // Prxima escrita a fazer
+static uint8_t store_slot = 0; // Registo mais recente
+static uint8_t store_seq = 0; // Nmero de sequncia do registo mais recente
+static uint8_t store_crc = 0; // CRC do registo mais recente
+static uint8_t store_valid = 0; // O registo mais recente contm a altura atual
+
+static const position_params_t default_params = {MAX_HEIGHT, MAX_HEIGHT, 0, 0, 0}; // Parmetros originais
+
+volatile uint16_t height = MAX_HEIGHT; // Altura atual, inicia no topo
+volatile uint32_t pos_acc = (uint32_t)MAX_HEIGHT << 8;
+volatile uint16_t pos_kick = 0;
+volatile uint16_t pos_coast = 0;
+uint8_t pos_coast_up = 0;
+uint8_t pos_outputs = 0;
+uint16_t pos_step_up = 256;
+uint16_t pos_step_down = 256;
+uint16_t pos_kick_up = 0;
+uint16_t pos_kick_down = 0;
+uint16_t pos_coast_time = 0;
+uint16_t pos_stop_up = 0;
+uint16_t pos_stop_down = 0;
+position_params_t pos_params;
+
+/* Verifica se os parmetros esto dentro dos limites */
+static uint8_t params_valid (const position_params_t *params){
+  return params->travel_up >= POS_TRAVEL_MIN && params->travel_up <= POS_TRAVEL_MAX
+      && params->travel_down >= POS_TRAVEL_MIN && params->travel_down <= POS_TRAVEL_MAX
+      && params->kick_up <= POS_KICK_MAX && params->kick_down <= POS_KICK_MAX
+      && params->coast <= POS_COAST_MAX;
+}
+
+/* Calcula os passos em vrgula fixa (as divises ficam fora da ISR) */
+static void apply (const position_params_t *params){
+  uint16_t up = ((uint32_t)MAX_HEIGHT << 8) / params->travel_up;
+  uint16_t down = ((uint32_t)MAX_HEIGHT << 8) / params->travel_down;
+
+  pos_params = *params;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // A ISR no pode usar um passo a meio da atualizao
+    pos_step_up = up;
+    pos_step_down = down;
+    pos_kick_up = params->kick_up;
+    pos_kick_down = params->kick_down;
+    pos_coast_time = params->coast;
+  }
+  pos_stop_up = ((uint32_t)params->coast * up) >> 9; // coast ms a metade do passo (ver position_tick())
+  pos_stop_down = ((uint32_t)params->coast * down) >> 9;
+  if (MOTOR_PWM){ // Mais a distncia da rampa de paragem
+    pos_stop_up += (MOTOR_STOP_TIME * up) >> 8;
+    pos_stop_down += (MOTOR_STOP_TIME * down) >> 8;
+  }
+}
+
+/* L os parmetros do modelo da EEPROM */
+void position_init (void){
+  position_params_t params;
+
+  eeprom_read_block(&params, &ee_pos_params, sizeof(params));
+  apply(params_valid(&params) ? &params : &default_params);
+}
+
+/* Altera (e guarda em EEPROM) os parmetros do modelo.
+ * Devolve 0 se estiverem fora dos limites */
+uint8_t position_configure (const position_params_t *params){
+  if (!params_valid(params)){
+    return 0;
+  }
+  eeprom_update_block(params, &ee_pos_params, sizeof(*params));
+  apply(params);
+  return 1;
+}
+
+/* Impe a altura atual (por exemplo, ao atingir um fim de curso) */
+void position_set (uint16_t h){
+  if (h > MAX_HEIGHT){
+    h = MAX_HEIGHT;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    pos_acc = (uint32_t)h << 8;
+    height = h;
+  }
+}
+
+/* A persiana est a deslizar depois de o motor desligar */
+uint8_t position_moving (void){
+  uint8_t moving;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // Leitura de 16 bits no pode ser interrompida pela ISR
+    moving = pos_coast != 0;
+  }
+  return moving;
+}
+
+/* CRC de um registo da altura guardada */
+static uint8_t slot_crc (uint8_t seq, uint16_t h){
+  uint8_t crc = _crc8_ccitt_update(0xA5, seq); // Valor inicial diferente de 0 para que zeros no sejam vlidos
+
+  crc = _crc8_ccitt_update(crc, h & 0xFF);
+  return _crc8_ccitt_update(crc, h >> 8);
+}
+
+/* Acrescenta a escrita de um byte da EEPROM  fila */
+static void store_byte (uint8_t *addr, uint8_t value){
+  store_addr[store_head] = addr;
+  store_value[store_head] = value;
+  store_head = (store_head + 1) & (STORE_QUEUE - 1);
+}
+
+/* Procura a altura guardada em EEPROM. Se for vlida, passa a ser a
+ * altura atual e devolve 1; seno devolve 0 e  preciso inicializar */
+uint8_t position_restore (void){
+  position_slot_t slot;
+  uint8_t i;
+  uint8_t seq;
+  uint16_t h;
+
+  for (i = 0; i < POS_SLOTS; i++){ // Procura o registo mais recente
+    seq = eeprom_read_byte(&ee_pos_slots[i].seq);
+    if (eeprom_read_byte(&ee_pos_slots[(i + 1) % POS_SLOTS].seq) != (uint8_t)(seq + 1)){
+      break;
+    }
+  }
+  if (POS_SLOTS == i){ // (no acontece, o nmero de sequncia no d a volta num mltiplo de POS_SLOTS)
+    i = 0;
+  }
+
+  eeprom_read_block(&slot, &ee_pos_slots[i], sizeof(slot));
+  h = slot.height_lo | (slot.height_hi << 8);
+  store_slot = i;
+  store_seq = slot.seq;
+  store_crc = slot.crc;
+  store_valid = (slot.crc == slot_crc(slot.seq, h)) && h <= MAX_HEIGHT;
+
+  if (store_valid){
+    position_set(h);
+  }
+  return store_valid;
+}
+
+/* Guarda a altura atual (chamada com a persiana parada). S escreve
+ * se a persiana se moveu desde a ltima vez que foi guardada */
+void position_save (void){
+  position_slot_t *slot;
+  uint16_t h;
+
+  if (store_valid || store_tail != store_head){ // Espera que as escritas anteriores terminem (a fila nunca enche)
+    return;
+  }
+
+  h = position_height();
+  store_slot = (store_slot + 1) % POS_SLOTS;
+  store_seq++;
+  store_crc = slot_crc(store_seq, h);
+  slot = &ee_pos_slots[store_slot];
+
+  store_byte(&slot->height_lo, h & 0xFF);
+  store_byte(&slot->height_hi, h >> 8);
+  store_byte(&slot->seq, store_seq);
+  store_byte(&slot->crc, store_crc); // O CRC  o ltimo, s ento o registo fica vlido
+  store_valid = 1;
+}
+
+/* Invalida a altura guardada (chamada quando o motor liga) */
+void position_invalidate (void){
+  if (!store_valid){
+    return;
+  }
+  store_byte(&ee_pos_slots[store_slot].crc, ~store_crc);
+  store_valid = 0;
+}
+
+/* Faz a prxima escrita pendente, se a EEPROM estiver livre */
+void position_poll (void){
+  if (store_tail != store_head && eeprom_is_ready()){
+    eeprom_write_byte(store_addr[store_tail], store_value[store_tail]);
+    store_tail = (store_tail + 1) & (STORE_QUEUE - 1);
+  }
+}
@@ -0,0 +1,214 @@
+/*
+ * position.h
+ *  Estimativa da posio da persiana a partir do tempo de motor
+ *  ligado, com velocidades de subida e descida diferentes
+ *
+ *  A altura ("height")  medida em unidades de 1ms de subida com a
+ *  persiana calibrada de fbrica, de 0 (fechada) a MAX_HEIGHT
+ *  (aberta), tal como originalmente, para que as constantes de
+ *  posio (PARAM_OPEN_TIME, alturas de referncia) no dependam
+ *  da calibrao. Em cada ms com o motor ligado a altura avana
+ *  step_up ou recua step_down, em vrgula fixa Q8.8:
+ *   step = 256 * MAX_HEIGHT / tempo_de_percurso
+ *  calculados fora da ISR sempre que os parmetros mudam, pelo que a
+ *  ISR apenas soma. Durante os primeiros kick_up/kick_down ms aps o
+ *  motor arrancar (ou mudar de direo) a persiana ainda no se move,
+ *  pelo que esse tempo no  contabilizado. Depois de o motor
+ *  desligar a persiana ainda desliza durante coast ms, abrandando at
+ *  parar; a altura continua a ser integrada nesse tempo, a metade do
+ *  passo (a distncia de uma desacelerao uniforme), no sentido em
+ *  que o motor estava a andar, mesmo que o rel da direo j tenha
+ *  mudado.
+ *
+ *  height  escrita pela ISR do timer 2 e tem 16 bits, que um AVR l
+ *  em duas instrues: fora da ISR deve ser lida com position_height(),
+ *  que desliga as interrupes apenas durante essas duas leituras,
+ *  para nunca obter metade de um valor antigo e metade de um novo.
+ *
+ *  A ltima altura conhecida  guardada em EEPROM quando a persiana
+ *  para, para que aps um reset o programa possa continuar sem
+ *  voltar a inicializar (ver position.c).
+ *
+ *  Fonte da posio (POS_SOURCE, escolhida na compilao):
+ *   POS_TIME       - estimada pelo tempo de motor ligado, como acima.
+ *   POS_HALL       - impulsos de um sensor de hall (um s canal) no
+ *                    pino PULSE_A (INT1): cada impulso avana ou recua
+ *                    a altura POS_PULSE_STEP, no sentido do motor (ou
+ *                    no sentido em que a persiana est a deslizar).
+ *   POS_QUADRATURE - encoder em quadratura: canal A em INT1, e o
+ *                    sentido dado pelo nvel do canal B (PULSE_B) em
+ *                    cada flanco ascendente de A (1 impulso por ciclo).
+ *  Com impulsos a altura  a posio real, sem erro acumulado; a ISR
+ *  do sensor faz a mesma soma que a ISR do timer faz com o tempo, e
+ *  o resto do programa (OPEN_X, *_AUTO, percentagens, altura
+ *  guardada) no muda. A persiana  dada como parada (pos_coast a 0)
+ *  POS_PULSE_TIMEOUT ms depois do ltimo impulso, o que continua a
+ *  atrasar as inverses at ela parar de facto. Os tempos de percurso
+ *  do modelo continuam a ser usados no tempo mximo de cada movimento
+ *  e para prever quanto a persiana desliza.
+ */
+
+#ifndef POSITION_H_
+#define POSITION_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+#define MAX_HEIGHT 13200 //13.2s para chegar  mxima altura (cronometrado - sujeito a erro)
+
+#define POS_TRAVEL_MIN 1000 // Tempo de percurso mnimo aceite (ms)
+#define POS_TRAVEL_MAX 60000 // Tempo de percurso mximo aceite (ms)
+#define POS_KICK_MAX 2000 // Atraso de arranque mximo aceite (ms)
+#define POS_COAST_MAX 1000 // Tempo mximo aceite a deslizar depois de o motor desligar (ms)
+
+#define POS_SLOTS 16 // Nmero de registos da altura guardada em EEPROM (desgaste distribudo)
+
+// Fontes da posio
+#define POS_TIME 0 // Tempo de motor ligado
+#define POS_HALL 1 // Impulsos de um sensor de hall
+#define POS_QUADRATURE 2 // Encoder em quadratura
+
+#ifndef POS_SOURCE
+#define POS_SOURCE POS_TIME
+#endif
+
+#ifndef POS_PULSES_TRAVEL
+#define POS_PULSES_TRAVEL 1000 // Impulsos do sensor num percurso completo (depende do sensor e da persiana)
+#endif
+#define POS_PULSE_STEP (((uint32_t)MAX_HEIGHT << 8) / POS_PULSES_TRAVEL) // Avano por impulso (Q8.8)
+#define POS_PULSE_TIMEOUT 100 // ms sem impulsos at a persiana ser dada como parada
+
+#if POS_SOURCE != POS_TIME && (MAX_HEIGHT * 256UL) / POS_PULSES_TRAVEL > 0xFFFF
+#error "POS_PULSES_TRAVEL demasiado pequeno (o avano por impulso tem de caber em 16 bits)"
+#endif
+
+typedef struct {
+  uint16_t travel_up; // Tempo de percurso completo a subir (ms)
+  uint16_t travel_down; // Tempo de percurso completo a descer (ms)
+  uint16_t kick_up; // Tempo desde que o motor liga at a persiana comear a subir (ms)
+  uint16_t kick_down; // Tempo desde que o motor liga at a persiana comear a descer (ms)
+  uint16_t coast; // Tempo desde que o motor desliga at a persiana parar (ms)
+} position_params_t;
+
+extern volatile uint16_t height; // Altura atual (parte inteira de pos_acc)
+extern volatile uint32_t pos_acc; // Altura atual em Q24.8
+extern volatile uint16_t pos_kick; // ms que ainda faltam do atraso de arranque
+extern volatile uint16_t pos_coast; // ms que a persiana ainda vai deslizar
+extern uint8_t pos_coast_up; // Sentido em que a persiana est a deslizar
+extern uint8_t pos_outputs; // Sadas do motor no ms anterior (bit 0 motor, bit 1 direo)
+extern uint16_t pos_step_up; // Avano por ms a subir (Q8.8)
+extern uint16_t pos_step_down; // Recuo por ms a descer (Q8.8)
+extern uint16_t pos_kick_up; // Atraso de arranque a subir (ms)
+extern uint16_t pos_kick_down; // Atraso de arranque a descer (ms)
+extern uint16_t pos_coast_time; // Tempo a deslizar depois de o motor desligar (ms)
+extern uint16_t pos_stop_up; // Distncia que a persiana desliza depois de o motor desligar a subir
+extern uint16_t pos_stop_down; // Distncia que a persiana desliza depois de o motor desligar a descer
+extern position_params_t pos_params; // Parmetros atuais
+
+void position_init(void);
+uint8_t position_configure(const position_params_t *params);
+void position_set(uint16_t h);
+uint8_t position_moving(void);
+
+uint8_t position_restore(void);
+void position_save(void);
+void position_invalidate(void);
+void position_poll(void);
+
+/* Altura atual (leitura atmica, pode ser chamada fora da ISR) */
+static inline uint16_t position_height (void){
+  uint16_t h;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    h = height;
+  }
+  return h;
+}
+
+/* Avana ou recua a altura "step" (Q8.8), sem passar dos limites
+ * (s deve ser chamada pelas ISR) */
+static inline void position_move (uint8_t up, uint16_t step){
+  if (up){
+    pos_acc += step;
+    if (pos_acc > ((uint32_t)MAX_HEIGHT << 8)){ // No passa da altura mxima
+      pos_acc = (uint32_t)MAX_HEIGHT << 8;
+    }
+  }
+  else if (pos_acc > step){
+    pos_acc -= step;
+  }
+  else { // No passa de fechada
+    pos_acc = 0;
+  }
+  height = pos_acc >> 8;
+}
+
+#if POS_SOURCE == POS_TIME
+/* Integra a posio durante 1ms (s deve ser chamada pela ISR do timer 2).
+ * "motor" e "up" so o estado atual das sadas do motor e da direo;
+ * "motor"  o nvel do motor (0 desligado, 255 a 100%, ver
+ * motor_level()) e o passo  proporcional a ele */
+static inline void position_tick (uint8_t motor, uint8_t up){
+  uint8_t now;
+  uint16_t step;
+
+  up = (up != 0);
+  now = motor ? (up ? 3 : 1) : 0;
+  if (now != pos_outputs){
+    if (!motor){ // Motor desligou: se a persiana j se movia, ainda desliza
+      pos_coast = pos_kick ? 0 : pos_coast_time;
+      pos_coast_up = (3 == pos_outputs);
+    }
+    else if (pos_coast && up == pos_coast_up){ // Voltou a ligar no mesmo sentido antes de parar: j est em movimento
+      pos_kick = 0;
+      pos_coast = 0;
+    }
+    else { // Motor arrancou ou mudou de direo: recomea o atraso de arranque
+      pos_kick = up ? pos_kick_up : pos_kick_down;
+      pos_coast = 0;
+    }
+    pos_outputs = now;
+  }
+
+  if (motor){
+    if (pos_kick){ // Motor ligado mas a persiana ainda no se move
+      pos_kick--;
+      return;
+    }
+    step = up ? pos_step_up : pos_step_down;
+    if (motor != 255){ // Motor em PWM, a acelerar ou a abrandar
+      step = ((uint32_t)step * motor) >> 8;
+    }
+  }
+  else if (pos_coast){ // Motor desligado mas a persiana ainda desliza
+    pos_coast--;
+    up = pos_coast_up;
+    step = (up ? pos_step_up : pos_step_down) >> 1;
+  }
+  else {
+    return;
+  }
+  position_move(up, step);
+}
+#else
+/* Acompanha o motor durante 1ms (s deve ser chamada pela ISR do
+ * timer 2): o sentido dos impulsos de um sensor de hall  o do motor,
+ * ou o ltimo enquanto a persiana desliza */
+static inline void position_tick (uint8_t motor, uint8_t up){
+  if (motor){
+    pos_coast_up = (up != 0);
+  }
+  if (pos_coast){ // Conta o tempo desde o ltimo impulso
+    pos_coast--;
+  }
+}
+
+/* Um impulso do sensor de posio (s deve ser chamada pela ISR de
+ * INT1). "b"  o nvel do canal B do encoder (ignorado com POS_HALL) */
+static inline void position_pulse (uint8_t b){
+  position_move((POS_QUADRATURE == POS_SOURCE) ? (b != 0) : pos_coast_up, POS_PULSE_STEP);
+  pos_coast = POS_PULSE_TIMEOUT; // A persiana est em movimento
+}
+#endif
+
+#endif /* POSITION_H_ */
@@ -0,0 +1,336 @@
+/*
+ * protocol.c
+ *  Protocolo de comandos por tramas (binrio) pela porta srie
+ *
+ *  A receo  feita por uma pequena mquina de estados alimentada
+ *  byte a byte pelo main() (protocol_feed()),  medida que este
+ *  esvazia o buffer de receo. Quando a trama est completa e o CRC
+ *  confere, os comandos so executados por ordem atravs de
+ *  protocol_execute() (implementada na aplicao) e a resposta 
+ *  colocada no buffer de transmisso. Ver protocol.h para o formato.
+ *  A resposta  construda j com o formato de uma trama (o payload
+ *  fica entre o cabealho e o CRC, em reply_frame) e copiada de uma
+ *  s vez para o buffer de transmisso, inteira ou nada, para que o
+ *  computador nunca receba uma resposta cortada.
+ *  Um comando s  executado se o seu cdigo e os dados que devolve
+ *  couberem na resposta, deixando sempre lugar para RSP_ERR e o cdigo
+ *  de erro; seno a execuo termina com ERR_FULL, para que nenhuma
+ *  resposta seja cortada a meio de um campo.
+ *  Tramas destinadas a outros ns so recebidas at ao fim (para
+ *  manter o sincronismo) mas no so executadas. Tramas para um grupo
+ *  ou para todos os ns no tm resposta numa linha partilhada, exceto
+ *  num n com uma janela configurada, que responde quando esta chega
+ *  (TMR_REPLY, ver bus.h); uma trama nova cancela a resposta pendente.
+ *  Numa linha partilhada cada n recebe tambm as respostas dos
+ *  outros (PROTO_SOF_REPLY), que so saltadas pelo seu tamanho (LEN):
+ *  os bytes delas nunca so tratados como comandos de um s caracter
+ *  nem como o incio de uma trama de pedido.
+ */
+
+#include "hal.h"
+#include "protocol.h"
+#include "serial.h"
+#include "bus.h"
+#include "timer.h"
+#include "update.h"
+
+// Estados do recetor de tramas
+#define RX_SOF 0 // Aguarda incio de trama
+#define RX_ADDR 1 // Aguarda endereo de destino
+#define RX_LEN 2 // Aguarda tamanho do payload
+#define RX_SEQ 3 // Aguarda nmero de sequncia
+#define RX_PAYLOAD 4 // Recebe payload
+#define RX_CRC 5 // Aguarda CRC
+
+static uint8_t rx_state = RX_SOF; // Estado do recetor
+static uint8_t rx_skip; // A trama em receo  a resposta de outro n (s  saltada)
+static uint8_t rx_addr; // Endereo de destino da trama em receo
+static uint8_t rx_len; // Tamanho do payload da trama em receo
+static uint8_t rx_seq; // Nmero de sequncia da trama em receo
+static uint8_t rx_count; // Bytes de payload j recebidos
+static uint8_t rx_crc; // CRC calculado  medida que se recebe
+static uint8_t rx_payload[PROTO_MAX_LEN]; // Payload da trama em receo
+
+#define REPLY_HEADER 4 // SOF, ADDR, LEN e SEQ antes do payload
+
+static uint8_t reply_frame[REPLY_HEADER + PROTO_MAX_LEN + 1]; // ltima resposta (guardada para retransmisses)
+static uint8_t * const reply = &reply_frame[REPLY_HEADER]; // Payload da ltima resposta
+static uint8_t reply_len; // Tamanho do payload da ltima resposta
+static uint8_t reply_seq; // Nmero de sequncia da ltima trama executada
+static uint8_t reply_addr; // Endereo de destino da ltima trama executada
+static uint8_t reply_valid = 0; // J foi executada alguma trama (reply_seq  vlido)
+static uint8_t reply_pending = 0; // A resposta aguarda a janela deste n (TMR_REPLY)
+
+uint16_t proto_crc_errors = 0;
+uint8_t proto_multicast = 0;
+
+/* Tamanho dos argumentos de cada comando (0xFF para comandos desconhecidos) */
+static uint8_t arg_len (uint8_t cmd){
+  switch (cmd){
+    case CMD_STOP:
+    case CMD_OPEN:
+    case CMD_CLOSE:
+    case CMD_QUERY:
+    case CMD_GET_MODEL:
+    case CMD_CALIBRATE:
+    case CMD_STATUS:
+    case CMD_GET_TIME:
+    case CMD_GET_CURRENT:
+    case CMD_FW_COMMIT:
+      return 0;
+    case CMD_SET_SLOT:
+    case CMD_GET_FAULT:
+    case CMD_FW_STATUS:
+    case CMD_GET_PARAM:
+    case CMD_SCENE:
+      return 1;
+    case CMD_GOTO_MS:
+    case CMD_GOTO_PERMILLE:
+    case CMD_SET_BAUD:
+      return 2;
+    case CMD_SET_ADDR:
+    case CMD_TELEMETRY:
+    case CMD_SET_SCENE:
+    case CMD_SET_PARAM:
+      return 3;
+    case CMD_SET_TIME:
+      return 4;
+    case CMD_FW_BEGIN:
+      return 5;
+    case CMD_SET_SCHEDULE:
+      return 6;
+    case CMD_SET_MODEL:
+      return 10;
+    case CMD_FW_BLOCK:
+      return 4 + UPDATE_BLOCK;
+    default:
+      return 0xFF;
+  }
+}
+
+/* Tamanho dos dados devolvidos por cada comando (ver protocol.h) */
+static uint8_t data_len (uint8_t cmd){
+  switch (cmd){
+    case CMD_QUERY:
+      return 5;
+    case CMD_STATUS:
+      return sizeof(proto_status_t);
+    case CMD_GET_MODEL:
+      return 11;
+    case CMD_GET_TIME:
+      return 4;
+    case CMD_GET_FAULT:
+      return 9;
+    case CMD_GET_PARAM:
+      return 8;
+    case CMD_GET_CURRENT:
+      return 3;
+    case CMD_FW_STATUS:
+      return 3 + UPDATE_STATUS_PAGES / 8;
+    default:
+      return 0;
+  }
+}
+
+/* Acrescenta um byte ao payload da resposta (descarta se no couber;
+ * execute_frame() s executa um comando se os seus dados couberem) */
+void protocol_reply_u8 (uint8_t value){
+  if (reply_len < PROTO_MAX_LEN){
+    reply[reply_len++] = value;
+  }
+}
+
+/* Acrescenta um valor de 16 bits (little-endian) ao payload da resposta */
+void protocol_reply_u16 (uint16_t value){
+  protocol_reply_u8(value & 0xFF);
+  protocol_reply_u8(value >> 8);
+}
+
+/* Reserva "len" bytes no payload da resposta, para serem preenchidos
+ * diretamente. Devolve NULL se no couberem */
+void *protocol_reply_reserve (uint8_t len){
+  void *p;
+
+  if (len > PROTO_MAX_LEN - reply_len){
+    return NULL;
+  }
+  p = &reply[reply_len];
+  reply_len += len;
+  return p;
+}
+
+/* Verifica se uma trama para este endereo deve ter resposta */
+static uint8_t reply_allowed (uint8_t addr){
+#if BUS_MODE == BUS_P2P
+  return 1; // No h outros ns com quem colidir
+#else
+  return !bus_is_multicast(addr);
+#endif
+}
+
+/* Envia a resposta guardada em "reply" */
+static void send_reply (void){
+  uint8_t crc = 0;
+  uint8_t i;
+
+  reply_frame[0] = PROTO_SOF_REPLY;
+  reply_frame[1] = bus_addr;
+  reply_frame[2] = reply_len;
+  reply_frame[3] = reply_seq;
+  for (i = 1; i < REPLY_HEADER + reply_len; i++){ // CRC de ADDR, LEN, SEQ e PAYLOAD
+    crc = _crc8_ccitt_update(crc, reply_frame[i]);
+  }
+  reply_frame[i] = crc;
+  usart_tx_write(reply_frame, i + 1); // Inteira ou nada
+}
+
+/* Responde a uma trama para este endereo: de imediato ou, se for para
+ * um grupo ou para todos numa linha partilhada, na janela deste n */
+static void reply_to (uint8_t addr){
+  if (reply_allowed(addr)){
+    send_reply();
+  }
+#if BUS_MODE != BUS_P2P
+  else if (bus_slot_set){ // S com uma janela configurada, nica no grupo
+    timer_start(TMR_REPLY, bus_offset());
+    reply_pending = 1;
+  }
+#endif
+}
+
+/* Executa todos os comandos de uma trama vlida e responde */
+static void execute_frame (void){
+  uint8_t i = 0;
+
+  reply_pending = 0; // (a resposta anterior j no interessa)
+  if (reply_valid && rx_seq == reply_seq && rx_addr == reply_addr){ // Retransmisso da trama anterior (para o mesmo endereo: uma trama para um grupo pode ter o SEQ da anterior, individual)
+    reply_to(rx_addr); // no volta a executar, apenas repete a resposta
+    return;
+  }
+
+  reply_len = 0;
+  reply_seq = rx_seq;
+  reply_addr = rx_addr;
+  reply_valid = 1;
+  proto_multicast = bus_is_multicast(rx_addr);
+
+  while (i < rx_len){
+    uint8_t cmd = rx_payload[i++];
+    uint8_t len = arg_len(cmd);
+    uint8_t err;
+
+    if (0xFF == len){
+      err = ERR_UNKNOWN;
+    }
+    else if (len > rx_len - i){
+      err = ERR_LENGTH;
+    }
+    else if (1 + data_len(cmd) + 2 > PROTO_MAX_LEN - reply_len){ // Cdigo e dados, deixando lugar para um erro no fim
+      err = ERR_FULL;
+    }
+    else {
+      protocol_reply_u8(cmd);
+      err = protocol_execute(cmd, &rx_payload[i]);
+      i += len;
+    }
+
+    if (err){ // Termina a execuo no primeiro erro
+      protocol_reply_u8(RSP_ERR);
+      protocol_reply_u8(err);
+      break;
+    }
+  }
+  reply_to(rx_addr);
+}
+
+/* Envia a resposta pendente quando chega a janela deste n */
+void protocol_poll (void){
+  if (reply_pending && timer_expired(TMR_REPLY)){
+    reply_pending = 0;
+    send_reply();
+  }
+}
+
+/* Descarta qualquer trama parcialmente recebida */
+void protocol_reset (void){
+  rx_state = RX_SOF;
+}
+
+/* Processa um byte recebido. Devolve 1 se o byte faz parte de uma
+ * trama, 0 se deve ser tratado como comando de um s caracter */
+uint8_t protocol_feed (uint8_t c){
+  switch (rx_state){
+    case RX_SOF:
+#if BUS_MODE != BUS_P2P
+      rx_skip = PROTO_SOF_REPLY == c;
+      if (rx_skip){ // Resposta de outro n na linha partilhada
+        rx_state = RX_ADDR;
+        break;
+      }
+#endif
+      if (PROTO_SOF != c){
+        return 0;
+      }
+      rx_skip = 0;
+      rx_state = RX_ADDR;
+      break;
+
+    case RX_ADDR:
+      rx_addr = c;
+      rx_crc = _crc8_ccitt_update(0, c);
+      rx_state = RX_LEN;
+      break;
+
+    case RX_LEN:
+      if (c > PROTO_MAX_LEN){ // Tamanho impossvel: no era uma trama
+        rx_state = RX_SOF;
+        break;
+      }
+      rx_len = c;
+      rx_crc = _crc8_ccitt_update(rx_crc, c);
+      rx_state = RX_SEQ;
+      break;
+
+    case RX_SEQ:
+      rx_seq = c;
+      rx_crc = _crc8_ccitt_update(rx_crc, c);
+      rx_count = 0;
+      rx_state = rx_len ? RX_PAYLOAD : RX_CRC;
+      break;
+
+    case RX_PAYLOAD:
+      rx_payload[rx_count++] = c;
+      rx_crc = _crc8_ccitt_update(rx_crc, c);
+      if (rx_count == rx_len){
+        rx_state = RX_CRC;
+      }
+      break;
+
+    case RX_CRC:
+      rx_state = RX_SOF;
+      if (rx_skip || !bus_match(rx_addr)){ // Resposta de outro n, ou trama para outro n
+        break;
+      }
+      if (c == rx_crc){
+        execute_frame();
+      }
+      else {
+        if (proto_crc_errors != 0xFFFF){
+          proto_crc_errors++;
+        }
+        if (reply_allowed(rx_addr)){ // CRC errado: avisa para que o computador retransmita
+          uint8_t nak[7] = {PROTO_SOF_REPLY, bus_addr, 2, rx_seq, RSP_ERR, ERR_CRC, 0};
+          uint8_t crc = 0;
+          uint8_t i;
+
+          for (i = 1; i < 6; i++){
+            crc = _crc8_ccitt_update(crc, nak[i]);
+          }
+          nak[6] = crc;
+          usart_tx_write(nak, sizeof(nak));
+        }
+      }
+      break;
+  }
+  return 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * protocol.h
+ *  Protocolo de comandos por tramas (binrio) pela porta srie
+ *
+ *  Formato de uma trama (valores de 16 bits em little-endian):
+ *   SOF | ADDR | LEN | SEQ | PAYLOAD[LEN] | CRC
+ *    SOF - incio de trama, PROTO_SOF nos pedidos e PROTO_SOF_REPLY
+ *          nas respostas (o eco de um pedido nunca  confundido com
+ *          uma resposta)
+ *    ADDR- nos pedidos, endereo do n, grupo ou difuso a que a
+ *          trama se destina (ver bus.h); nas respostas, endereo do
+ *          n que responde. Tramas para outros ns so ignoradas
+ *    LEN - nmero de bytes do payload (mximo PROTO_MAX_LEN)
+ *    SEQ - nmero de sequncia escolhido pelo computador, devolvido
+ *          na resposta. Uma trama com o mesmo SEQ e ADDR da anterior
+ *           tratada como retransmisso: no  executada outra vez,
+ *          apenas se reenvia a resposta anterior
+ *    CRC - CRC-8 (polinmio 0x07) de ADDR, LEN, SEQ e PAYLOAD
+ *
+ *  O payload  uma sequncia de comandos, cada um com um cdigo
+ *  (CMD_*) seguido dos seus argumentos, de tamanho fixo. A resposta
+ *  contm, por ordem, o cdigo de cada comando executado seguido dos
+ *  dados que devolve. Ao primeiro erro a execuo termina e a
+ *  resposta acaba com RSP_ERR seguido do cdigo de erro (ERR_*).
+ *
+ *  Os bytes recebidos fora de uma trama continuam a ser os comandos
+ *  de um s caracter ('u', 'g', '0'~'9') e, na ligao ponto-a-ponto,
+ *  os bytes que ativam uma cena (SCENE_BYTE+n, ver schedule.h).
+ */
+
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdint.h>
+
+#define PROTO_SOF 0xA5 // Incio de trama de pedido (no  um caracter ASCII)
+#define PROTO_SOF_REPLY 0x5A // Incio de trama de resposta
+#define PROTO_MAX_LEN 32 // Tamanho mximo do payload
+#define PROTO_TIMEOUT 20 // ms sem receber bytes a meio de uma trama at a descartar
+
+// Comandos (cdigo | argumentos -> dados devolvidos)
+#define CMD_STOP 0x01 // - -> - : para a persiana
+#define CMD_OPEN 0x02 // - -> - : abre completamente (como 'u')
+#define CMD_CLOSE 0x03 // - -> - : fecha completamente (como '0')
+#define CMD_GOTO_MS 0x04 // u16 altura em ms -> - : abre/fecha at  altura indicada
+#define CMD_GOTO_PERMILLE 0x05 // u16 abertura em 0.1% -> - : abre/fecha at  abertura indicada
+#define CMD_QUERY 0x06 // - -> u8 estado, u16 altura, u16 altura de referncia
+#define CMD_SET_ADDR 0x07 // u8 endereo, u16 mscara de grupos -> - : configura o endereamento (EEPROM)
+#define CMD_TELEMETRY 0x08 // u16 perodo em ms (0 desliga), u8 modo (TLM_*) -> - : configura a telemetria (s em BUS_P2P, ver telemetry.h)
+#define CMD_GET_MODEL 0x09 // - -> u16 percurso a subir, u16 percurso a descer, u16 arranque a subir, u16 arranque a descer, u16 deslizar (ms), u8 resultado da ltima calibrao
+#define CMD_SET_MODEL 0x0A // u16 percurso a subir, u16 percurso a descer, u16 arranque a subir, u16 arranque a descer, u16 deslizar (ms) -> -
+#define CMD_CALIBRATE 0x0B // - -> - : mede os tempos de percurso entre os fins de curso e guarda-os (CMD_GET_MODEL)
+#define CMD_SET_BAUD 0x0C // u16 velocidade em 100 bps -> - : muda a velocidade da porta srie depois da resposta (ver baud.h)
+#define CMD_STATUS 0x0D // - -> proto_status_t : estado completo do n, de tamanho fixo (para consultar muitos ns)
+#define CMD_SET_TIME 0x0E // u32 hora do dia em ms desde a meia-noite -> - : acerta o relgio do horrio (ver schedule.h)
+#define CMD_GET_TIME 0x0F // - -> u32 hora do dia em ms desde a meia-noite (0xFFFFFFFF se no foi acertada)
+#define CMD_SET_SCHEDULE 0x10 // u8 entrada, u16 minuto do dia (0xFFFF apaga), u16 altura em ms, u8 grupo (0xFF todos) -> - : altera o horrio (EEPROM)
+#define CMD_SET_SCENE 0x11 // u8 cena, u16 altura em ms (0xFFFF no participa) -> - : altera a altura deste n numa cena (EEPROM)
+#define CMD_SET_SLOT 0x12 // u8 janela (0xFF derivada do endereo) -> - : altera a janela do arranque escalonado e das respostas (EEPROM, ver bus.h)
+#define CMD_GET_FAULT 0x13 // u8 n (0 a mais recente) -> u8 cdigo (FAULT_*), u8 estado, u16 altura, u32 ms desde o arranque, u8 repeties : registo de falhas (ver supervisor.h)
+#define CMD_GET_CURRENT 0x14 // - -> u16 corrente filtrada (ADC em Q4, 0 sem CURRENT_SENSE), u8 fim de curso detetado (CUR_*) : ver current.h
+#define CMD_FW_BEGIN 0x15 // u8 slot, u16 tamanho, u16 CRC-16 da imagem -> - : abre (ou retoma) a receo de uma imagem nova (ver update.h)
+#define CMD_FW_BLOCK 0x16 // u16 bloco, u16 CRC-16 do bloco, 16 bytes de imagem -> - : bloco da imagem nova
+#define CMD_FW_STATUS 0x17 // u8 primeira pgina (mltiplo de 8) -> u8 slot em execuo, u16 pginas em falta, 8 bytes de mapa das pginas em falta
+#define CMD_FW_COMMIT 0x18 // - -> - : verifica a imagem e arranca com ela,  experincia, depois da resposta
+#define CMD_GET_PARAM 0x19 // u8 parmetro (PARAM_*) -> u16 valor, u16 mnimo, u16 mximo, u16 original : ver params.h
+#define CMD_SET_PARAM 0x1A // u8 parmetro (PARAM_*), u16 valor -> - : altera um parmetro da persiana (EEPROM)
+#define CMD_SCENE 0x1B // u8 cena -> - : pe a persiana na sua altura da cena (nada se no participa), como SCENE_BYTE+n
+
+#define RSP_ERR 0xFF // Seguido do cdigo de erro
+
+// Cdigos de erro
+#define ERR_CRC 0x01 // CRC errado (a trama foi ignorada)
+#define ERR_UNKNOWN 0x02 // Comando desconhecido
+#define ERR_LENGTH 0x03 // Faltam argumentos ao comando
+#define ERR_RANGE 0x04 // Argumento fora dos limites
+#define ERR_BUSY 0x05 // Comando no permitido no estado atual
+#define ERR_FULL 0x06 // A resposta no cabe em PROTO_MAX_LEN (demasiados comandos na trama)
+#define ERR_VERIFY 0x07 // A imagem recebida est incompleta ou no confere com o CRC
+
+/* Resposta a CMD_STATUS. Sem enchimento e little-endian como o AVR,
+ * pelo que  preenchida diretamente na resposta, campo a campo, e
+ * enviada tal como est em memria (sem qualquer formatao). Os
+ * contadores saturam no mximo */
+typedef struct __attribute__((packed)) {
+  uint8_t state; // Estado da mquina de estados
+  uint8_t io; // Bits TLM_IO_* (motor, direo e botes)
+  uint16_t height; // Altura atual
+  uint16_t height_reference; // Altura de referncia (estado OPEN_X)
+  uint32_t uptime; // ms desde o arranque
+  uint16_t rx_overflow; // Caracteres perdidos por o buffer de receo estar cheio
+  uint16_t tx_dropped; // Escritas perdidas por o buffer de transmisso estar cheio
+  uint16_t crc_errors; // Tramas para este n recebidas com CRC errado
+  uint16_t version; // Verso da firmware (FIRMWARE_VERSION)
+} proto_status_t;
+
+void protocol_reset(void);
+uint8_t protocol_feed(uint8_t c);
+void protocol_poll(void);
+
+extern uint16_t proto_crc_errors; // Tramas para este n com CRC errado
+extern uint8_t proto_multicast; // A trama em execuo  para um grupo ou para todos
+
+void protocol_reply_u8(uint8_t value);
+void protocol_reply_u16(uint16_t value);
+void *protocol_reply_reserve(uint8_t len);
+
+/* Implementada pela aplicao: executa um comando cujos argumentos
+ * (j validados em tamanho) esto em "arg". Pode acrescentar dados 
+ * resposta com protocol_reply_*() (ou preench-los diretamente no
+ * espao devolvido por protocol_reply_reserve()). Devolve 0 ou um
+ * cdigo ERR_* */
+uint8_t protocol_execute(uint8_t cmd, const uint8_t *arg);
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,117 @@
+/*
+ * schedule.c
+ *  Horrio de movimentos guardado em EEPROM e cenas
+ *
+ *  A hora do dia no  guardada: apenas o valor do relgio de 1ms
+ *  (millis()) no momento em que foi acertada e a hora nesse momento,
+ *  pelo que a hora atual  sempre calculada a partir do relgio, sem
+ *  trabalho na ISR. schedule_poll() s l a tabela da EEPROM quando
+ *  passa um minuto (uma leitura da EEPROM  imediata, ao contrrio
+ *  das escritas), pelo que nada do horrio ocupa RAM.
+ *  Uma EEPROM apagada (0xFF) corresponde a um horrio vazio e a um n
+ *  que no participa em nenhuma cena.
+ */
+
+#include "hal.h"
+#include "schedule.h"
+#include "bus.h"
+#include "clock.h"
+#include "position.h"
+
+typedef struct {
+  uint16_t minute; // Minuto do dia (0~1439), ou SCHED_EMPTY
+  uint16_t height; // Altura de referncia a atingir
+  uint8_t group; // Grupo (0~14) a que se destina, ou SCHED_ALL
+} sched_entry_t;
+
+static sched_entry_t EEMEM ee_schedule[SCHED_ENTRIES] = {[0 ... SCHED_ENTRIES-1] = {SCHED_EMPTY, 0, SCHED_ALL}}; // Horrio guardado em EEPROM
+static uint16_t EEMEM ee_scenes[SCENES] = {[0 ... SCENES-1] = SCENE_NONE}; // Altura deste n em cada cena
+
+static uint8_t synced = 0; // A hora j foi acertada
+static uint32_t sync_clock; // Valor de millis() quando a hora foi acertada
+static uint32_t sync_time; // Hora do dia (ms desde a meia-noite) nesse momento
+static uint32_t next_minute; // Valor de millis() em que comea o prximo minuto a verificar
+
+/* Hora do dia (ms desde a meia-noite) no instante "now" (valor de millis()) */
+static uint32_t time_at (uint32_t now){
+  return (sync_time + (now - sync_clock)) % DAY_MS;
+}
+
+/* Acerta a hora do dia (ms desde a meia-noite).
+ * Devolve 0 se no for uma hora vlida */
+uint8_t schedule_set_time (uint32_t ms){
+  uint32_t now = millis();
+
+  if (ms >= DAY_MS){
+    return 0;
+  }
+  sync_clock = now;
+  sync_time = ms;
+  next_minute = now + (MINUTE_MS - ms % MINUTE_MS) % MINUTE_MS; // Um minuto que comea agora ainda  executado
+  synced = 1;
+  return 1;
+}
+
+/* Hora do dia atual (ms desde a meia-noite), ou 0xFFFFFFFF se ainda no foi acertada */
+uint32_t schedule_time (void){
+  return synced ? time_at(millis()) : 0xFFFFFFFF;
+}
+
+/* Altera (e guarda em EEPROM) uma entrada do horrio; SCHED_EMPTY
+ * como minuto apaga-a. Devolve 0 se algum valor estiver fora dos limites */
+uint8_t schedule_set (uint8_t index, uint16_t minute, uint16_t height, uint8_t group){
+  sched_entry_t entry;
+
+  if (index >= SCHED_ENTRIES || (minute >= DAY_MINUTES && SCHED_EMPTY != minute)
+      || height > MAX_HEIGHT || (group > 14 && SCHED_ALL != group)){
+    return 0;
+  }
+  entry.minute = minute;
+  entry.height = height;
+  entry.group = group;
+  eeprom_update_block(&entry, &ee_schedule[index], sizeof(entry));
+  return 1;
+}
+
+/* Verifica o horrio quando passa um minuto. Devolve a altura de
+ * referncia da entrada deste minuto destinada a este n (se houver
+ * vrias, a ltima), ou SCHED_NONE */
+uint16_t schedule_poll (void){
+  uint32_t now = millis();
+  uint16_t minute;
+  uint16_t result = SCHED_NONE;
+  sched_entry_t entry;
+  uint8_t i;
+
+  if (!synced || (int32_t)(now - next_minute) < 0){ // (comparao que funciona quando millis() d a volta)
+    return SCHED_NONE;
+  }
+  minute = time_at(now) / MINUTE_MS;
+  next_minute += MINUTE_MS;
+
+  for (i = 0; i < SCHED_ENTRIES; i++){
+    eeprom_read_block(&entry, &ee_schedule[i], sizeof(entry));
+    if (entry.minute == minute && entry.height <= MAX_HEIGHT
+        && (SCHED_ALL == entry.group || (entry.group <= 14 && ((bus_groups >> entry.group) & 1)))){
+      result = entry.height;
+    }
+  }
+  return result;
+}
+
+/* Altera (e guarda em EEPROM) a altura deste n numa cena; SCENE_NONE
+ * retira-o da cena. Devolve 0 se algum valor estiver fora dos limites */
+uint8_t scene_set (uint8_t scene, uint16_t height){
+  if (scene >= SCENES || (height > MAX_HEIGHT && SCENE_NONE != height)){
+    return 0;
+  }
+  eeprom_update_word(&ee_scenes[scene], height);
+  return 1;
+}
+
+/* Altura deste n numa cena, ou SCENE_NONE se no participa nela */
+uint16_t scene_height (uint8_t scene){
+  uint16_t height = eeprom_read_word(&ee_scenes[scene & (SCENES-1)]);
+
+  return (height <= MAX_HEIGHT) ? height : SCENE_NONE;
+}
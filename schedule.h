@@ -0,0 +1,67 @@
+/*
+ * schedule.h
+ *  Horrio de movimentos guardado em EEPROM e cenas
+ *
+ *  Horrio:
+ *   O computador acerta a hora do dia (CMD_SET_TIME, normalmente por
+ *   difuso, uma vez por dia) e a persiana passa a cont-la sozinha a
+ *   partir do relgio de 1ms (clock.h). A tabela do horrio tem
+ *   SCHED_ENTRIES entradas, cada uma com o minuto do dia, a altura de
+ *   referncia a atingir e o grupo a que se destina (0~14, ver bus.h,
+ *   ou SCHED_ALL para todos os ns). Como cada n s executa as
+ *   entradas dos seus grupos, a mesma tabela pode ser enviada a todos
+ *   por difuso. Ao passar o minuto de uma entrada a persiana vai
+ *   para a altura indicada, como com CMD_GOTO_MS, sem que nada tenha
+ *   de ser transmitido: o trfego deixa de crescer com o nmero de
+ *   ns. Enquanto a hora no for acertada (ou depois de um reset) o
+ *   horrio no  executado.
+ *   Com o cristal de 16MHz (50ppm) o relgio desvia-se no mximo
+ *   cerca de 4s por dia; com um ressonador cermico (0.5%) chega a
+ *   7 minutos, pelo que a hora deve ser acertada mais vezes.
+ *
+ *  Cenas:
+ *   Cada n guarda a sua altura para cada uma de SCENES cenas (os
+ *   nomes ficam no computador), ou SCENE_NONE se no participa nela.
+ *   Na ligao ponto-a-ponto um s byte SCENE_BYTE+n recebido fora de
+ *   uma trama pe a persiana na cena n. Numa linha partilhada (ver
+ *   bus.h) os bytes das tramas dos outros ns tambm chegam a cada
+ *   n, e qualquer um deles pode valer SCENE_BYTE+n, pelo que a cena
+ *    pedida por trama (CMD_SCENE), normalmente por difuso: sem
+ *   resposta, com os arranques escalonados pelas janelas dos ns.
+ */
+
+#ifndef SCHEDULE_H_
+#define SCHEDULE_H_
+
+#include <stdint.h>
+
+#define SCHED_ENTRIES 16 // Entradas do horrio em EEPROM
+#define SCHED_ALL 0xFF // Grupo de uma entrada destinada a todos os ns
+#define SCHED_EMPTY 0xFFFF // Minuto de uma entrada vazia (ou apagada)
+#define SCHED_NONE 0xFFFF // Devolvido por schedule_poll() quando no h movimento a fazer
+#define DAY_MS 86400000UL // ms num dia
+#define MINUTE_MS 60000UL // ms num minuto
+#define DAY_MINUTES 1440 // Minutos num dia
+
+#define SCENES 8 // Cenas guardadas em EEPROM (tem de ser potncia de 2)
+#define SCENE_BYTE 0xB0 // Byte que ativa a cena 0 (as seguintes at SCENE_BYTE+SCENES-1, sem ser ASCII)
+#define SCENE_NONE 0xFFFF // Altura de uma cena em que este n no participa
+
+#if SCENES & (SCENES-1)
+#error "SCENES tem de ser uma potncia de 2"
+#endif
+
+uint8_t schedule_set_time(uint32_t ms);
+uint32_t schedule_time(void);
+uint8_t schedule_set(uint8_t index, uint16_t minute, uint16_t height, uint8_t group);
+uint16_t schedule_poll(void);
+
+uint8_t scene_set(uint8_t scene, uint16_t height);
+uint16_t scene_height(uint8_t scene);
+
+/* Verifica se um byte recebido fora de uma trama ativa uma cena */
+static inline uint8_t scene_byte (uint8_t c){
+  return SCENE_BYTE == (c & ~(SCENES-1));
+}
+
+#endif /* SCHEDULE_H_ */
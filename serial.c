@@ -1,9 +1,21 @@
 /*****************************************************************************
  * serial.c
- *  Redirection of the printf stream to the AVR serial port
- *    1. Initialize usart @ 57600 bps (change in BAUD)
- *    2. Define the low level put_char mechanism
- *    3. Redirect the printf io stream
+ *  Serial port driver: the only place the USART is configured
+ *    1. Initialize the usart: 8N1, RX interrupt, baud rate from EEPROM
+ *       (see baud.h), 9-bit multiprocessor mode with BUS_MPCM
+ *    2. Receive interrupt, feeding the controller's RX ring (rx_put())
+ *    3. Transmit ring buffer, drained by USART_UDRE_vect
+ *    4. Redirect the printf io stream (kept for experiments; the DEBUG
+ *       output uses the fixed-format emitters in serial_fmt.c instead)
+ *
+ *  Characters are not written to UDR0 directly: they are queued in a
+ *  transmit ring buffer that is drained by the USART_UDRE_vect interrupt,
+ *  so neither printf nor the receive echo ever wait for the transmitter.
+ *  When the buffer is full the character is dropped (and counted).
+ *
+ *  On an RS-485 bus (BUS_MODE != BUS_P2P, see bus.h) the transceiver
+ *  driver is enabled through BUS_DE before the first byte is queued and
+ *  released from USART_TX_vect once the last stop bit has left the line.
  *
  *  Created on: 13/09/2016
  *      Author: jpsousa@fe.up.pt (eclipse + gcc-avr)
@@ -11,22 +23,165 @@
 
 #include <stdio.h>
 #include <avr/io.h>          /* Register definitions*/
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "hal.h"             /* BUS_DE and profiling pins */
+#include "serial.h"
+#include "bus.h"
+#include "baud.h"
+#include "controller.h"      /* rx_put() */
+
+#define TX_BUF_MASK (TX_BUF_SIZE-1)
+
+#if (TX_BUF_SIZE & TX_BUF_MASK) || (TX_BUF_SIZE > 256)
+#error "TX_BUF_SIZE must be a power of 2 up to 256"
+#endif
 
-#define F_CPU 16000000UL               /* 16 MHz    */
-#define	BAUD 57600                     /* baud rate */
-#define BAUDGEN ((F_CPU/(16*BAUD))-1)  /* divider   */
+static volatile uint8_t tx_buf[TX_BUF_SIZE];
+static volatile uint8_t tx_head = 0;   /* next free slot (producers)  */
+static volatile uint8_t tx_tail = 0;   /* next byte to send (UDRE isr) */
+static volatile uint16_t tx_dropped = 0;
 
 void usart_init(void) {
-  UBRR0 = BAUDGEN;
-  UCSR0B = (1 << RXEN0) | (1 << TXEN0);
-  UCSR0C = (1 << USBS0) | (3 << UCSZ00);
+  baud_init();                         /* UBRR0 and U2X0 */
+  UCSR0C = (3 << UCSZ00);              /* 8 data bits, no parity, 1 stop bit */
+#if BUS_MODE == BUS_MPCM
+  UCSR0A |= (1 << MPCM0);              /* only address characters until selected */
+  UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0) | (1 << UCSZ02);
+#else
+  UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
+#endif
+}
+
+ISR(USART_RX_vect) {
+  PROFILE_ENTER(PROFILE_RX);
+#if BUS_MODE == BUS_MPCM
+  if (UCSR0B & (1 << RXB80)) {         /* address character (read the 9th bit before UDR0) */
+    uint8_t addr = UDR0;
+
+    if (bus_match(addr)) {             /* for this node: receive the data that follows */
+      UCSR0A &= (1 << U2X0);           /* (MPCM0 cleared, TXC0 left alone) */
+      bus_selected = addr;             /* group or broadcast: moves are staggered */
+    }
+    else {                             /* not for us: let the hardware drop it */
+      UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << MPCM0);
+    }
+    PROFILE_EXIT(PROFILE_RX);
+    return;
+  }
+#endif
+  rx_put(UDR0);
+  PROFILE_EXIT(PROFILE_RX);
 }
 
+/* Queue one byte for transmission, never waits.
+ * Safe to call from the main loop and from other interrupt handlers.
+ * Returns 0 on success, -1 if the buffer was full and the byte dropped. */
+int usart_tx_put(uint8_t c) {
+  int ret = -1;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t next = (tx_head + 1) & TX_BUF_MASK;
+
+    if (next != tx_tail) {
+      tx_buf[tx_head] = c;
+      tx_head = next;
+#if BUS_MODE != BUS_P2P
+      PORTD |= (1 << BUS_DE);          /* take the bus before sending */
+      UCSR0B &= ~(1 << TXCIE0);
+#endif
+      UCSR0B |= (1 << UDRIE0);         /* (re)start the UDRE interrupt */
+      ret = 0;
+    }
+    else if (tx_dropped != 0xFFFF) {
+      tx_dropped++;
+    }
+  }
+  return ret;
+}
+
+/* Queue a block of bytes for transmission, all or nothing, never waits.
+ * Used for binary records that must never reach the host truncated.
+ * Returns 0 on success, -1 if it did not fit (nothing is queued). */
+int usart_tx_write(const uint8_t *data, uint8_t len) {
+  int ret = -1;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t head = tx_head;
+
+    if (len <= ((tx_tail - head - 1) & TX_BUF_MASK)) {
+      while (len--) {
+        tx_buf[head] = *data++;
+        head = (head + 1) & TX_BUF_MASK;
+      }
+      tx_head = head;
+#if BUS_MODE != BUS_P2P
+      PORTD |= (1 << BUS_DE);
+      UCSR0B &= ~(1 << TXCIE0);
+#endif
+      UCSR0B |= (1 << UDRIE0);
+      ret = 0;
+    }
+    else if (tx_dropped != 0xFFFF) {
+      tx_dropped++;
+    }
+  }
+  return ret;
+}
+
+uint16_t usart_tx_dropped(void) {
+  uint16_t count;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    count = tx_dropped;
+  }
+  return count;
+}
+
+/* Nothing queued and the last stop bit has left the line. Used to
+ * change the baud rate (or reset) only after a reply has been sent
+ * completely. Point to point, TXC0 says so (it is cleared before every
+ * byte, so it is never stale). On a bus USART_TX_vect clears TXC0 when
+ * it releases BUS_DE, so the released driver is the sign instead: it
+ * is only dropped once both the UDRE and TXC interrupts are done. */
+int usart_tx_idle(void) {
+  int idle;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if BUS_MODE != BUS_P2P
+    idle = tx_tail == tx_head && !(UCSR0B & ((1 << UDRIE0) | (1 << TXCIE0))) && !(PORTD & (1 << BUS_DE));
+#else
+    idle = tx_tail == tx_head && (UCSR0A & (1 << TXC0));
+#endif
+  }
+  return idle;
+}
+
+ISR(USART_UDRE_vect) {
+  uint8_t tail = tx_tail;
+
+  if (tail == tx_head) {               /* nothing left: stop interrupting */
+    UCSR0B &= ~(1 << UDRIE0);
+#if BUS_MODE != BUS_P2P
+    UCSR0B |= (1 << TXCIE0);           /* release the bus after the last bit */
+#endif
+    return;
+  }
+  /* clear a stale TXC0 (write one); FE0/DOR0/UPE0 must be written zero */
+  UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+  UDR0 = tx_buf[tail];
+  tx_tail = (tail + 1) & TX_BUF_MASK;
+}
+
+#if BUS_MODE != BUS_P2P
+ISR(USART_TX_vect) {
+  UCSR0B &= ~(1 << TXCIE0);
+  PORTD &= ~(1 << BUS_DE);             /* back to receive */
+}
+#endif
+
 int usart_putchar(char c, FILE *stream) {
-  while (!( UCSR0A & (1 << UDRE0)))
-    ;
-  UDR0 = c;
-  return 0;
+  return usart_tx_put((uint8_t)c);
 }
 
 static FILE mystdout = FDEV_SETUP_STREAM(usart_putchar, NULL, _FDEV_SETUP_WRITE);
@@ -34,4 +189,3 @@ static FILE mystdout = FDEV_SETUP_STREAM(usart_putchar, NULL, _FDEV_SETUP_WRITE)
 void printf_init(void) {
   stdout = &mystdout;
 }
-
@@ -1,6 +1,6 @@
 /*
  * serial.h
- *  Redirection of the printf stream to the AVR serial port
+ *  Serial port driver (serial.c) and fixed-format emitters (serial_fmt.c)
  *  Header file
  *  Created on: 13/09/2016
  *      Author: jpsousa@fe.up.pt
@@ -10,9 +10,27 @@
 #define SERIAL_H_
 
 #include <stdio.h>
+#include <stdint.h>
+
+#ifndef TX_BUF_SIZE
+#define TX_BUF_SIZE 128   /* transmit ring buffer size (power of 2) */
+#endif
 
 void usart_init(void);
+int usart_tx_put(uint8_t c);
+int usart_tx_write(const uint8_t *data, uint8_t len);
+uint16_t usart_tx_dropped(void);
+int usart_tx_idle(void);
 int usart_putchar(char c, FILE *stream);
 void printf_init(void);
 
+/* Fixed-format output straight into the transmit ring, no printf and
+ * no stdio. Strings passed to usart_puts_P must be in program memory
+ * (PSTR("...")). Like usart_tx_put, they drop characters that do not
+ * fit instead of waiting. */
+void usart_puts(const char *s);
+void usart_puts_P(const char *s);
+void usart_put_dec(uint16_t value);
+void usart_put_hex(uint8_t value);
+
 #endif /* SERIAL_H_ */
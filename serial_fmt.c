@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * serial_fmt.c
+ *  Fixed-format emitters for the serial port, a few dozen bytes of flash
+ *  instead of the several KB that vfprintf pulls in, and a bounded,
+ *  short run time (no format string to parse, no 32-bit arithmetic).
+ *  Hardware independent: only uses usart_tx_put(), so the same code runs
+ *  in the native simulation (sim/).
+ *****************************************************************************/
+
+#include "hal.h"             /* pgm_read_byte */
+#include "serial.h"
+
+void usart_puts(const char *s) {
+  while (*s) {
+    usart_tx_put((uint8_t)*s++);
+  }
+}
+
+void usart_puts_P(const char *s) {
+  char c;
+
+  while ((c = pgm_read_byte(s++))) {
+    usart_tx_put((uint8_t)c);
+  }
+}
+
+/* Unsigned decimal, no leading zeros */
+void usart_put_dec(uint16_t value) {
+  char digits[5];
+  uint8_t n = 0;
+
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) {
+    usart_tx_put((uint8_t)digits[--n]);
+  }
+}
+
+/* Two hex digits */
+void usart_put_hex(uint8_t value) {
+  static const char hex[16] PROGMEM = "0123456789abcdef";
+
+  usart_tx_put((uint8_t)pgm_read_byte(&hex[value >> 4]));
+  usart_tx_put((uint8_t)pgm_read_byte(&hex[value & 0x0F]));
+}
@@ -0,0 +1,21 @@
+/*
+ * hal_sim.c
+ *  Estado dos pinos na simulao nativa (ver hal_sim.h)
+ */
+
+#include "hal_sim.h"
+
+uint8_t sim_motor = 0;
+uint8_t sim_dir = 0;
+uint8_t sim_duty = 255;
+uint8_t sim_buttons = 0;
+uint8_t sim_top = 0;
+uint8_t sim_bottom = 0;
+uint16_t sim_ubrr = 0;
+uint8_t sim_u2x = 0;
+uint8_t sim_adc = 0;
+uint8_t sim_pulse_b = 0;
+uint8_t sim_flash[0x8000] = {[0 ... 0x7FFF] = 0xFF}; // (flash apagada)
+uint8_t sim_boot_record[16] = {[0 ... 15] = 0xFF}; // (EEPROM apagada)
+uint8_t sim_eeprom_fixed[0x400] = {[0 ... 0x3FF] = 0xFF};
+uint8_t sim_resets = 0;
@@ -0,0 +1,116 @@
+/*
+ * hal_sim.h
+ *  Acesso ao "hardware" na simulao nativa (ver hal.h)
+ *
+ *  Os pinos so variveis do simulador (hal_sim.c), lidas e escritas
+ *  pelo modelo da persiana em sim.c. A EEPROM, a memria de programa
+ *  e os blocos atmicos da avr-libc passam a ser memria e blocos
+ *  normais: a simulao corre numa s thread e a "ISR" do timer 
+ *  chamada entre passagens do ciclo principal.
+ */
+
+#ifndef HAL_SIM_H_
+#define HAL_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Mesmos nmeros de pino que hal_avr.h (os botes so mscaras destes bits)
+#define MOTOR 0
+#define DIR 1
+#define ENDSTOP_TOP 4
+#define ENDSTOP_BOTTOM 5
+#define CLOSE 6
+#define OPEN 7
+
+// Estado dos pinos (hal_sim.c)
+extern uint8_t sim_motor; // Sada do motor (1 -> ligado)
+extern uint8_t sim_dir; // Sada da direo (1 -> para cima)
+extern uint8_t sim_duty; // Duty cycle do motor ligado (apenas com MOTOR_PWM)
+extern uint8_t sim_buttons; // Botes premidos (bits CLOSE e OPEN)
+extern uint8_t sim_top; // Fim de curso superior ativo
+extern uint8_t sim_bottom; // Fim de curso inferior ativo
+extern uint16_t sim_ubrr; // Divisor da porta srie
+extern uint8_t sim_u2x; // Porta srie com 8 amostras por bit
+extern uint8_t sim_adc; // ADC a converter (free-running)
+extern uint8_t sim_pulse_b; // Canal B do encoder de posio
+extern uint8_t sim_flash[0x8000]; // Memria de programa (imagens A e B)
+extern uint8_t sim_boot_record[16]; // Registo de arranque na EEPROM (ver boot/boot.h)
+extern uint8_t sim_eeprom_fixed[0x400]; // EEPROM dos endereos fixos (hal_eeprom_fixed())
+extern uint8_t sim_resets; // Resets pedidos pela firmware (hal_reset())
+
+// avr/pgmspace.h e avr/eeprom.h: a memria de programa e a EEPROM so RAM
+#define PROGMEM
+#define PSTR(s) (s)
+#define EEMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+static inline uint8_t eeprom_read_byte (const uint8_t *addr){ return *addr; }
+static inline uint16_t eeprom_read_word (const uint16_t *addr){ return *addr; }
+static inline void eeprom_read_block (void *dst, const void *src, size_t n){ memcpy(dst, src, n); }
+static inline void eeprom_write_byte (uint8_t *addr, uint8_t value){ *addr = value; }
+static inline void eeprom_update_byte (uint8_t *addr, uint8_t value){ *addr = value; }
+static inline void eeprom_update_word (uint16_t *addr, uint16_t value){ *addr = value; }
+static inline void eeprom_update_block (const void *src, void *dst, size_t n){ memcpy(dst, src, n); }
+static inline uint8_t eeprom_is_ready (void){ return 1; }
+
+// util/atomic.h: sem interrupes reais o bloco executa uma vez
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (uint8_t atomic_once = 1; atomic_once; atomic_once = 0)
+
+// util/crc16.h
+static inline uint8_t _crc8_ccitt_update (uint8_t crc, uint8_t data){
+  uint8_t i;
+
+  crc ^= data;
+  for (i = 0; i < 8; i++){
+    crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  }
+  return crc;
+}
+
+static inline uint16_t _crc16_update (uint16_t crc, uint8_t data){
+  uint8_t i;
+
+  crc ^= data;
+  for (i = 0; i < 8; i++){
+    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+  }
+  return crc;
+}
+
+#include "boot/boot.h"
+
+static inline void hal_motor_init (void){ sim_motor = 0; }
+static inline uint8_t hal_motor_on (void){ return sim_motor; }
+static inline void hal_motor_set (uint8_t on){ sim_motor = on; }
+static inline void hal_motor_duty (uint8_t duty){ sim_duty = duty; }
+static inline uint8_t hal_dir_up (void){ return sim_dir; }
+static inline void hal_dir_set (uint8_t up){ sim_dir = up; }
+static inline void hal_buttons_init (void){ }
+static inline uint8_t hal_buttons (void){ return sim_buttons; }
+static inline void hal_endstop_init (void){ }
+static inline uint8_t hal_endstop_top (void){ return sim_top; }
+static inline uint8_t hal_endstop_bottom (void){ return sim_bottom; }
+static inline void hal_pulse_init (uint8_t quadrature){ (void)quadrature; }
+static inline uint8_t hal_pulse_b (void){ return sim_pulse_b; }
+static inline void hal_usart_baud (uint16_t ubrr, uint8_t u2x){ sim_ubrr = ubrr; sim_u2x = u2x; }
+static inline void hal_timer_init (uint8_t top){ (void)top; }
+static inline uint8_t hal_timer_count (void){ return 0; }
+static inline uint8_t hal_timer_pending (void){ return 0; }
+static inline void hal_adc_start (void){ sim_adc = 1; }
+static inline void hal_adc_stop (void){ sim_adc = 0; }
+static inline void hal_wdt_init (void){ }
+static inline void hal_wdt_reset (void){ }
+static inline uint8_t hal_boot_slot (void){ return 0; }
+static inline void *hal_eeprom_fixed (uint16_t addr){ return &sim_eeprom_fixed[addr]; }
+static inline void *hal_boot_record (void){ return sim_boot_record; }
+static inline uint8_t hal_flash_read (uint16_t addr){ return sim_flash[addr]; }
+static inline void hal_flash_write (uint16_t addr, const uint8_t *buf){ memcpy(&sim_flash[addr], buf, BOOT_PAGE_SIZE); }
+static inline void hal_reset (void){ sim_resets++; }
+
+#endif /* HAL_SIM_H_ */
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * serial_sim.c
+ *  serial.h for the native simulation (see sim/sim.c)
+ *
+ *  Same transmit ring buffer as serial.c, with the same drop-when-full
+ *  behaviour, but drained by the simulator (sim_tx_get()) at the line
+ *  rate instead of by USART_UDRE_vect. The DEBUG output (serial_fmt.c)
+ *  goes through this buffer like on the target; printf already goes to
+ *  the host stdout, so printf_init() does nothing.
+ *
+ *  On a bus (BUS_MODE != BUS_P2P) the transceiver driver is modelled
+ *  too: taken by every queued byte and released by the simulator once
+ *  the buffer has drained completely, like USART_TX_vect, so that
+ *  usart_tx_idle() only becomes true after the last byte has left.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include "../serial.h"
+#include "../baud.h"
+#include "../bus.h"
+
+#define TX_BUF_MASK (TX_BUF_SIZE-1)
+
+#if (TX_BUF_SIZE & TX_BUF_MASK) || (TX_BUF_SIZE > 256)
+#error "TX_BUF_SIZE must be a power of 2 up to 256"
+#endif
+
+static uint8_t tx_buf[TX_BUF_SIZE];
+static uint8_t tx_head = 0;   /* next free slot (producers) */
+static uint8_t tx_tail = 0;   /* next byte to send (simulator) */
+static uint16_t tx_dropped = 0;
+static uint8_t tx_de = 0;     /* transceiver driver enabled (BUS_DE) */
+
+void usart_init(void) {
+  baud_init();               /* only records the divisor, see hal_sim.h */
+}
+
+int usart_tx_put(uint8_t c) {
+  uint8_t next = (tx_head + 1) & TX_BUF_MASK;
+
+  if (next != tx_tail) {
+    tx_buf[tx_head] = c;
+    tx_head = next;
+    tx_de = (BUS_MODE != BUS_P2P);
+    return 0;
+  }
+  if (tx_dropped != 0xFFFF) {
+    tx_dropped++;
+  }
+  return -1;
+}
+
+int usart_tx_write(const uint8_t *data, uint8_t len) {
+  if (len > ((tx_tail - tx_head - 1) & TX_BUF_MASK)) {
+    if (tx_dropped != 0xFFFF) {
+      tx_dropped++;
+    }
+    return -1;
+  }
+  while (len--) {
+    tx_buf[tx_head] = *data++;
+    tx_head = (tx_head + 1) & TX_BUF_MASK;
+  }
+  tx_de = (BUS_MODE != BUS_P2P);
+  return 0;
+}
+
+uint16_t usart_tx_dropped(void) {
+  return tx_dropped;
+}
+
+int usart_tx_idle(void) {
+  return tx_tail == tx_head && !tx_de;
+}
+
+/* Next byte "on the line", or -1 if the buffer is empty (which also
+ * means the last byte has been sent: the bus driver is released) */
+int sim_tx_get(void) {
+  uint8_t c;
+
+  if (tx_tail == tx_head) {
+    tx_de = 0;
+    return -1;
+  }
+  c = tx_buf[tx_tail];
+  tx_tail = (tx_tail + 1) & TX_BUF_MASK;
+  return c;
+}
+
+int usart_putchar(char c, FILE *stream) {
+  return usart_tx_put((uint8_t)c);
+}
+
+void printf_init(void) {
+}
@@ -0,0 +1,821 @@
+/*
+ * sim.c
+ *  Simulao nativa do controlador da persiana
+ *
+ *  Corre o cdigo do controlador (controller.c e mdulos) no
+ *  computador, contra um modelo da persiana, a partir de ficheiros de
+ *  eventos ("traces"). Cada ms simulado:
+ *   1. aplica os eventos desse ms (botes, caracteres recebidos);
+ *   2. entrega  "ISR de receo" (rx_put) os caracteres que cabem
+ *      num ms  velocidade da porta srie (SIM_RX_PER_MS);
+ *   3. chama controller_tick(), como a ISR do timer 2;
+ *   4. avana o modelo da persiana com as sadas do motor;
+ *   5. envia os caracteres que cabem num ms do buffer de transmisso;
+ *   6. chama controller_poll() at o estado deixar de mudar, como o
+ *      ciclo principal antes de adormecer;
+ *   7. avalia as verificaes ("expect") desse ms.
+ *  A simulao tem a resoluo de 1ms (no conta ciclos do CPU): as
+ *  latncias medidas so o nmero de ms entre um evento e a reao,
+ *  e assumem que o ciclo principal nunca demora mais do que 1ms.
+ *
+ *  O modelo da persiana integra a altura tal como position_tick()
+ *  (tempos de percurso, atraso de arranque e tempo a deslizar), mas
+ *  com parmetros prprios ("plant ..."), para que se possa medir o
+ *  erro da estimativa quando o modelo da firmware no coincide com a
+ *  persiana real. Os fins de curso ficam ativos nos limites do
+ *  percurso. Conta as inverses bruscas: rel da direo mudado com o
+ *  motor ligado, ou motor ligado no sentido oposto ao da persiana
+ *  enquanto esta ainda desliza. Com POS_SOURCE diferente de POS_TIME
+ *  o modelo gera tambm os impulsos do sensor de posio (um por cada
+ *  POS_PULSE_STEP percorrido, como a ISR de INT1). Com MOTOR_PWM a
+ *  velocidade da persiana  proporcional ao duty cycle do motor.
+ *
+ *  Cada trace corre num processo prprio (fork), para que as
+ *  variveis globais dos mdulos comecem sempre com os valores
+ *  iniciais e a EEPROM simulada comece vazia.
+ *
+ *  Formato de um trace (uma linha por evento, # inicia um comentrio,
+ *  <t> em ms desde o arranque, por ordem crescente):
+ *   plant travel_up|travel_down|kick_up|kick_down|coast <ms>
+ *   plant height <altura>       altura inicial da persiana
+ *   <t> press|release open|close
+ *   <t> click open|close <ms>   prime e larga ao fim de <ms>
+ *   <t> rx <texto>              caracteres (\n, \r, \\ e \xHH)
+ *   <t> frame [@addr] <cmd> [bytes]
+ *                               trama para addr, ou para BUS_ADDR_DEFAULT
+ *                               (hexadecimal)
+ *   <t> baud <bps>              velocidade do computador (57600 no incio); os
+ *                               caracteres chegam como 0x00 se a da persiana
+ *                               diferir mais de 4.5%
+ *   <t> expect state <nome>
+ *   <t> expect height|plant <altura> [tolerncia]
+ *   <t> expect error <mximo>   diferena entre a estimativa e a persiana
+ *   <t> expect motor off|up|down
+ *   <t> expect reversals <n>
+ *   <t> expect baud <bps>       velocidade pedida  porta srie da persiana
+ *   <t> expect reply <n>        tamanho do payload da resposta  ltima trama
+ *                               (-1 se ainda no respondeu)
+ *   <t> expect resets <n>       resets pedidos pela firmware (atualizao)
+ *   end <t>                     fim da simulao (por omisso 1s depois do ltimo evento)
+ *
+ *  Utilizao: sim [-v] [-t] [-r N] trace...
+ *   -v   mostra as mudanas de estado, do motor e as latncias
+ *   -t   mostra os caracteres transmitidos (texto do debug; os
+ *        restantes em \xHH)
+ *   -r N corre cada trace N vezes e mostra os cenrios por segundo
+ *  O cdigo de sada  diferente de 0 se alguma verificao falhar.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../controller.h"
+#include "../protocol.h"
+#include "../baud.h"
+
+#define SIM_RX_PER_MS 5 // Caracteres por ms a 57600 bps (10 bits por caracter, arredondado por defeito)
+#define SIM_TX_PER_MS 5
+#define SIM_POLL_MAX 16 // Passagens mximas pelo ciclo principal num ms
+#define SIM_EVENTS 1024 // Eventos mximos num trace
+#define SIM_RX_QUEUE 1024 // Caracteres  espera de ser recebidos
+#define SIM_ADC_PER_MS 10 // Amostras do ADC por ms (free-running a 125kHz, 13 ciclos por converso: ~9.6)
+
+// Corrente do motor simulada (valor do ADC, 8 bits, com CURRENT_SENSE)
+#define SIM_CUR_OFF 2 // Motor desligado (rudo)
+#define SIM_CUR_RUN 80 // A mover a persiana
+#define SIM_CUR_INRUSH 220 // Nos primeiros SIM_INRUSH_MS depois de ligar
+#define SIM_CUR_STALL 200 // Contra o limite do percurso
+#define SIM_INRUSH_MS 100
+
+int sim_tx_get(void); // serial_sim.c
+
+// Tipos de evento
+#define EV_PRESS 0
+#define EV_RELEASE 1
+#define EV_RX 2
+#define EV_FRAME 3
+#define EV_EXPECT_STATE 4
+#define EV_EXPECT_HEIGHT 5
+#define EV_EXPECT_PLANT 6
+#define EV_EXPECT_ERROR 7
+#define EV_EXPECT_MOTOR 8
+#define EV_EXPECT_REVERSALS 9
+#define EV_BAUD 10
+#define EV_EXPECT_BAUD 11
+#define EV_EXPECT_REPLY 12
+#define EV_EXPECT_RESETS 13
+
+typedef struct {
+  uint32_t t; // Instante (ms)
+  int line; // Linha do trace
+  uint8_t type; // EV_*
+  int32_t value; // Boto, valor esperado...
+  int32_t tol; // Tolerncia das verificaes de altura
+  uint8_t seq; // Nmero de sequncia (EV_FRAME)
+  uint8_t len; // Caracteres em data
+  uint8_t data[PROTO_MAX_LEN + 5];
+} event_t;
+
+static const char *state_names[STATE_COUNT] = {
+  "INIT", "IDLE", "CLOSE_CHECK", "OPEN_CHECK", "OPEN_AUTO",
+  "CLOSE_AUTO", "CLOSE_MANUAL", "OPEN_MANUAL", "OPEN_X", "CALIBRATE"
+};
+
+static const char *motor_names[3] = {"off", "up", "down"};
+
+static event_t events[SIM_EVENTS];
+static int event_count = 0;
+static uint32_t end_time = 0; // 0 -> 1s depois do ltimo evento
+static int verbose = 0;
+static int show_tx = 0;
+static const char *trace_name;
+
+// Modelo da persiana
+static uint16_t plant_travel_up = MAX_HEIGHT;
+static uint16_t plant_travel_down = MAX_HEIGHT;
+static uint16_t plant_kick_up = 0;
+static uint16_t plant_kick_down = 0;
+static uint16_t plant_coast_time = 0;
+static uint32_t plant_acc = (uint32_t)(MAX_HEIGHT / 2) << 8; // Altura em Q24.8 (comea a meio)
+static uint8_t plant_on = 0; // Motor ligado no ms anterior
+static uint8_t plant_up = 0; // Sentido do motor (ou do deslizar)
+static uint16_t plant_kick = 0; // ms que faltam do atraso de arranque
+static uint16_t plant_coast = 0; // ms que a persiana ainda vai deslizar
+static uint32_t plant_on_ms = 0; // ms desde que o motor ligou
+static unsigned plant_reversals = 0; // Inverses bruscas
+static uint32_t plant_pulses = ((uint32_t)(MAX_HEIGHT / 2) << 8) / POS_PULSE_STEP; // Impulsos do sensor de posio at  altura atual
+
+// Receo e transmisso
+static uint8_t rx_queue[SIM_RX_QUEUE];
+static unsigned rx_queue_head = 0;
+static unsigned rx_queue_tail = 0;
+static uint32_t host_baud = 57600; // Velocidade do computador
+static uint8_t tx_window[4]; // ltimos 4 caracteres transmitidos (incio de uma resposta)
+static unsigned long tx_count = 0;
+
+// Latncias
+static int react_line = 0; // Linha do evento que espera uma reao (0 -> nenhum)
+static uint32_t react_time;
+static int reply_line = 0; // Linha da trama que espera resposta (0 -> nenhuma)
+static uint32_t reply_time;
+static uint8_t reply_seq;
+static int reply_len = -1; // Tamanho do payload da resposta  ltima trama
+static unsigned react_n = 0, reply_n = 0;
+static uint32_t react_sum = 0, react_max = 0, reply_sum = 0, reply_max = 0;
+
+static unsigned checks = 0, failures = 0;
+
+/* Altura da persiana simulada */
+static uint16_t plant_height (void){
+  return plant_acc >> 8;
+}
+
+/* Sadas do motor como OUT_* */
+static uint8_t motor_outputs (void){
+  return !sim_motor ? OUT_OFF : (sim_dir ? OUT_UP : OUT_DOWN);
+}
+
+/* Move a persiana simulada "step" (Q8.8) no sentido plant_up */
+static void plant_move (uint16_t step){
+  if (plant_up){
+    plant_acc += step;
+    if (plant_acc > ((uint32_t)MAX_HEIGHT << 8)){
+      plant_acc = (uint32_t)MAX_HEIGHT << 8;
+    }
+  }
+  else {
+    plant_acc = (plant_acc > step) ? plant_acc - step : 0;
+  }
+}
+
+#if POS_SOURCE != POS_TIME
+/* Gera um impulso do sensor de posio por cada POS_PULSE_STEP que a
+ * persiana percorreu (canal B a 1 a subir) */
+static void plant_pulse (void){
+  uint32_t now = plant_acc / POS_PULSE_STEP;
+
+  while (plant_pulses != now){
+    sim_pulse_b = plant_pulses < now;
+    plant_pulses += sim_pulse_b ? 1 : -1;
+    position_pulse(hal_pulse_b());
+  }
+}
+#endif
+
+/* Avana o modelo da persiana 1ms com as sadas atuais */
+static void plant_step (void){
+  uint8_t up = sim_dir != 0;
+  uint16_t step;
+
+  if (sim_motor){
+    if (!plant_on || up != plant_up){ // Motor arrancou ou mudou de direo
+      if ((plant_on && up != plant_up) || (plant_coast && up != plant_up)){
+        plant_reversals++; // Rel mudado com o motor ligado, ou contra a persiana ainda em movimento
+      }
+      plant_kick = (plant_coast && up == plant_up) ? 0 : (up ? plant_kick_up : plant_kick_down);
+      plant_coast = 0;
+      plant_on = 1;
+      plant_up = up;
+      plant_on_ms = 0;
+    }
+    plant_on_ms++;
+    if (plant_kick){
+      plant_kick--;
+    }
+    else {
+      step = ((uint32_t)MAX_HEIGHT << 8) / (up ? plant_travel_up : plant_travel_down);
+      if (MOTOR_PWM && sim_duty != 255){ // A velocidade acompanha o duty cycle
+        step = ((uint32_t)step * sim_duty) >> 8;
+      }
+      plant_move(step);
+    }
+  }
+  else {
+    if (plant_on){ // Motor desligou: se a persiana j se movia, ainda desliza
+      plant_coast = plant_kick ? 0 : plant_coast_time;
+      plant_on = 0;
+    }
+    if (plant_coast){
+      plant_coast--;
+      step = ((uint32_t)MAX_HEIGHT << 8) / (plant_up ? plant_travel_up : plant_travel_down);
+      plant_move(step >> 1);
+    }
+  }
+
+  sim_top = plant_acc >= ((uint32_t)MAX_HEIGHT << 8);
+  sim_bottom = 0 == plant_acc;
+#if POS_SOURCE != POS_TIME
+  plant_pulse();
+#endif
+}
+
+/* Corrente do motor simulada (valor lido pelo ADC) */
+static uint8_t plant_current (void){
+  if (!sim_motor){
+    return SIM_CUR_OFF;
+  }
+  if (plant_on_ms <= SIM_INRUSH_MS){
+    return SIM_CUR_INRUSH;
+  }
+  if ((sim_dir && sim_top) || (!sim_dir && sim_bottom)){ // O motor empurra contra o limite
+    return SIM_CUR_STALL;
+  }
+  return SIM_CUR_RUN;
+}
+
+/* Os caracteres do computador so recebidos corretamente (a
+ * velocidade real da porta srie difere no mximo 4.5%) */
+static int baud_match (void){
+  uint32_t actual = F_CPU / ((sim_u2x ? 8 : 16) * ((uint32_t)sim_ubrr + 1));
+  uint32_t diff = (actual > host_baud) ? actual - host_baud : host_baud - actual;
+
+  return diff * 1000 <= host_baud * 45;
+}
+
+static const char *state_name (uint8_t s){
+  return (s < STATE_COUNT) ? state_names[s] : "ILLEGAL";
+}
+
+static int parse_state (const char *name){
+  int i;
+
+  for (i = 0; i < STATE_COUNT; i++){
+    if (!strcmp(name, state_names[i])){
+      return i;
+    }
+  }
+  return !strcmp(name, "ILLEGAL") ? ILLEGAL : -1;
+}
+
+static int parse_button (const char *name){
+  if (!strcmp(name, "open")){
+    return 1 << OPEN;
+  }
+  if (!strcmp(name, "close")){
+    return 1 << CLOSE;
+  }
+  return -1;
+}
+
+static int parse_motor (const char *name){
+  int i;
+
+  for (i = 0; i < 3; i++){
+    if (!strcmp(name, motor_names[i])){
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void fail_parse (int line, const char *what){
+  fprintf(stderr, "%s:%d: %s\n", trace_name, line, what);
+  exit(2);
+}
+
+/* Acrescenta um evento, mantendo a ordem por instante (estvel) */
+static event_t *add_event (uint32_t t, int line, uint8_t type){
+  int i;
+
+  if (SIM_EVENTS == event_count){
+    fail_parse(line, "demasiados eventos");
+  }
+  for (i = event_count; i > 0 && events[i - 1].t > t; i--){
+    events[i] = events[i - 1];
+  }
+  event_count++;
+  memset(&events[i], 0, sizeof(events[i]));
+  events[i].t = t;
+  events[i].line = line;
+  events[i].type = type;
+  return &events[i];
+}
+
+/* Converte o texto de um evento rx (com \n, \r, \\ e \xHH) */
+static uint8_t parse_text (const char *s, uint8_t *out, int line){
+  uint8_t len = 0;
+
+  while (*s){
+    uint8_t c = *s++;
+
+    if ('\\' == c){
+      c = *s++;
+      if ('n' == c){
+        c = '\n';
+      }
+      else if ('r' == c){
+        c = '\r';
+      }
+      else if ('x' == c){
+        char hex[3] = {s[0], s[0] ? s[1] : 0, 0};
+
+        c = strtoul(hex, NULL, 16);
+        s += strlen(hex);
+      }
+      else if ('\\' != c){
+        fail_parse(line, "sequncia de escape desconhecida");
+      }
+    }
+    if (len == sizeof(events[0].data)){
+      fail_parse(line, "texto demasiado comprido");
+    }
+    out[len++] = c;
+  }
+  return len;
+}
+
+/* L um trace */
+static void load_trace (const char *name){
+  FILE *f = fopen(name, "r");
+  char buf[256];
+  int line = 0;
+  uint8_t seq = 0;
+  uint32_t last = 0;
+
+  if (!f){
+    perror(name);
+    exit(2);
+  }
+  while (fgets(buf, sizeof(buf), f)){
+    char word[32], arg[32];
+    char *p, *rest;
+    unsigned long t;
+    int n;
+    event_t *ev;
+
+    line++;
+    buf[strcspn(buf, "\r\n")] = 0;
+    p = buf + strspn(buf, " \t");
+    if (!*p || '#' == *p){
+      continue;
+    }
+
+    if (!strncmp(p, "plant ", 6)){
+      unsigned long v;
+      if (2 != sscanf(p + 6, "%31s %lu", word, &v)){
+        fail_parse(line, "plant <parmetro> <valor>");
+      }
+      if (!strcmp(word, "travel_up") && v >= POS_TRAVEL_MIN) plant_travel_up = v;
+      else if (!strcmp(word, "travel_down") && v >= POS_TRAVEL_MIN) plant_travel_down = v;
+      else if (!strcmp(word, "kick_up")) plant_kick_up = v;
+      else if (!strcmp(word, "kick_down")) plant_kick_down = v;
+      else if (!strcmp(word, "coast")) plant_coast_time = v;
+      else if (!strcmp(word, "height") && v <= MAX_HEIGHT){
+        plant_acc = (uint32_t)v << 8;
+        plant_pulses = plant_acc / POS_PULSE_STEP; // A altura inicial no gera impulsos
+      }
+      else fail_parse(line, "parmetro da persiana desconhecido ou fora dos limites");
+      continue;
+    }
+    if (1 == sscanf(p, "end %lu", &t)){
+      end_time = t;
+      continue;
+    }
+
+    if (2 != sscanf(p, "%lu %31s%n", &t, word, &n)){
+      fail_parse(line, "<t> <evento> ...");
+    }
+    if (t < last){
+      fail_parse(line, "eventos fora de ordem");
+    }
+    last = t;
+    rest = p + n + strspn(p + n, " \t");
+
+    if (!strcmp(word, "press") || !strcmp(word, "release")){
+      ev = add_event(t, line, ('p' == word[0]) ? EV_PRESS : EV_RELEASE);
+      if ((ev->value = parse_button(rest)) < 0){
+        fail_parse(line, "boto desconhecido");
+      }
+    }
+    else if (!strcmp(word, "click")){
+      unsigned long ms;
+      int button;
+
+      if (2 != sscanf(rest, "%31s %lu", arg, &ms) || (button = parse_button(arg)) < 0){
+        fail_parse(line, "click open|close <ms>");
+      }
+      add_event(t, line, EV_PRESS)->value = button;
+      add_event(t + ms, line, EV_RELEASE)->value = button;
+    }
+    else if (!strcmp(word, "rx")){
+      ev = add_event(t, line, EV_RX);
+      ev->len = parse_text(rest, ev->data, line);
+    }
+    else if (!strcmp(word, "frame")){
+      uint8_t payload[PROTO_MAX_LEN];
+      uint8_t addr = BUS_ADDR_DEFAULT;
+      uint8_t len = 0;
+      uint8_t crc;
+      uint8_t i;
+      char *end;
+
+      if ('@' == *rest){ // Endereo de destino (individual, grupo ou difuso)
+        unsigned long a = strtoul(rest + 1, &end, 16);
+
+        if (end == rest + 1 || a > 0xFF){
+          fail_parse(line, "frame [@addr] <cmd> [bytes] (hexadecimal, at PROTO_MAX_LEN)");
+        }
+        addr = a;
+        rest = end + strspn(end, " \t");
+      }
+      while (*rest){
+        unsigned long b = strtoul(rest, &end, 16);
+
+        if (end == rest || b > 0xFF || len == PROTO_MAX_LEN){
+          fail_parse(line, "frame [@addr] <cmd> [bytes] (hexadecimal, at PROTO_MAX_LEN)");
+        }
+        payload[len++] = b;
+        rest = end + strspn(end, " \t");
+      }
+      ev = add_event(t, line, EV_FRAME);
+      ev->seq = ++seq; // Nunca repete o anterior (no  uma retransmisso)
+      ev->data[0] = PROTO_SOF;
+      ev->data[1] = addr;
+      ev->data[2] = len;
+      ev->data[3] = ev->seq;
+      memcpy(&ev->data[4], payload, len);
+      crc = 0;
+      for (i = 1; i < 4 + len; i++){
+        crc = _crc8_ccitt_update(crc, ev->data[i]);
+      }
+      ev->data[4 + len] = crc;
+      ev->len = 5 + len;
+    }
+    else if (!strcmp(word, "baud")){
+      add_event(t, line, EV_BAUD)->value = strtol(rest, NULL, 10);
+    }
+    else if (!strcmp(word, "expect")){
+      long v;
+      long tol = 50;
+
+      if (2 > sscanf(rest, "%31s %31s %ld", word, arg, &tol)){
+        fail_parse(line, "expect <o qu> <valor>");
+      }
+      v = strtol(arg, NULL, 10);
+      if (!strcmp(word, "state")){
+        ev = add_event(t, line, EV_EXPECT_STATE);
+        if ((ev->value = parse_state(arg)) < 0){
+          fail_parse(line, "estado desconhecido");
+        }
+      }
+      else if (!strcmp(word, "motor")){
+        ev = add_event(t, line, EV_EXPECT_MOTOR);
+        if ((ev->value = parse_motor(arg)) < 0){
+          fail_parse(line, "motor off|up|down");
+        }
+      }
+      else {
+        if (!strcmp(word, "height")) ev = add_event(t, line, EV_EXPECT_HEIGHT);
+        else if (!strcmp(word, "plant")) ev = add_event(t, line, EV_EXPECT_PLANT);
+        else if (!strcmp(word, "error")) ev = add_event(t, line, EV_EXPECT_ERROR);
+        else if (!strcmp(word, "reversals")) ev = add_event(t, line, EV_EXPECT_REVERSALS);
+        else if (!strcmp(word, "baud")) ev = add_event(t, line, EV_EXPECT_BAUD);
+        else if (!strcmp(word, "reply")) ev = add_event(t, line, EV_EXPECT_REPLY);
+        else if (!strcmp(word, "resets")) ev = add_event(t, line, EV_EXPECT_RESETS);
+        else fail_parse(line, "verificao desconhecida");
+        ev->value = v;
+        ev->tol = tol;
+      }
+    }
+    else {
+      fail_parse(line, "evento desconhecido");
+    }
+  }
+  fclose(f);
+
+  if (!end_time){
+    end_time = (event_count ? events[event_count - 1].t : 0) + 1000;
+  }
+}
+
+/* Aplica um evento de entrada */
+static void apply_input (const event_t *ev, uint32_t now){
+  uint8_t i;
+
+  if (EV_FRAME == ev->type){ // Espera tambm pela resposta
+    reply_line = ev->line;
+    reply_time = now;
+    reply_seq = ev->seq;
+    reply_len = -1;
+  }
+
+  switch (ev->type){
+  case EV_PRESS:
+    sim_buttons |= ev->value;
+    btn_div = 1; // Como a ISR PCINT2 (a mudana  amostrada j no prximo ms)
+    break;
+  case EV_RELEASE:
+    sim_buttons &= ~ev->value;
+    btn_div = 1;
+    break;
+  case EV_BAUD: // No espera reao
+    host_baud = ev->value;
+    return;
+  case EV_FRAME:
+  case EV_RX:
+    for (i = 0; i < ev->len; i++){
+      if (rx_queue_head - rx_queue_tail == SIM_RX_QUEUE){
+        fail_parse(ev->line, "demasiados caracteres  espera de ser recebidos");
+      }
+      rx_queue[rx_queue_head++ % SIM_RX_QUEUE] = ev->data[i];
+    }
+    break;
+  default:
+    return;
+  }
+  react_line = ev->line;
+  react_time = now;
+}
+
+/* Avalia uma verificao */
+static void check (const event_t *ev, uint32_t now){
+  int32_t got;
+  int ok;
+  uint16_t h = position_height();
+  uint16_t p = plant_height();
+
+  switch (ev->type){
+  case EV_EXPECT_STATE:
+    got = state;
+    ok = got == ev->value;
+    break;
+  case EV_EXPECT_MOTOR:
+    got = motor_outputs();
+    ok = got == ev->value;
+    break;
+  case EV_EXPECT_HEIGHT:
+    got = h;
+    ok = labs(got - ev->value) <= ev->tol;
+    break;
+  case EV_EXPECT_PLANT:
+    got = p;
+    ok = labs(got - ev->value) <= ev->tol;
+    break;
+  case EV_EXPECT_ERROR:
+    got = (h > p) ? h - p : p - h;
+    ok = got <= ev->value;
+    break;
+  case EV_EXPECT_REVERSALS:
+    got = plant_reversals;
+    ok = got == ev->value;
+    break;
+  case EV_EXPECT_BAUD:
+    got = (int32_t)baud_rate * 100;
+    ok = got == ev->value;
+    break;
+  case EV_EXPECT_REPLY:
+    got = reply_len;
+    ok = got == ev->value;
+    break;
+  case EV_EXPECT_RESETS:
+    got = sim_resets;
+    ok = got == ev->value;
+    break;
+  default:
+    return;
+  }
+
+  checks++;
+  if (!ok){
+    failures++;
+    if (EV_EXPECT_STATE == ev->type){
+      printf("%s:%d: t=%u esperado estado %s, obtido %s\n", trace_name, ev->line, now, state_name(ev->value), state_name(got));
+    }
+    else if (EV_EXPECT_MOTOR == ev->type){
+      printf("%s:%d: t=%u esperado motor %s, obtido %s\n", trace_name, ev->line, now, motor_names[ev->value], motor_names[got]);
+    }
+    else {
+      printf("%s:%d: t=%u esperado %d, obtido %d\n", trace_name, ev->line, now, ev->value, got);
+    }
+  }
+}
+
+/* Regista a latncia de um evento */
+static void latency (const char *what, int line, uint32_t since, uint32_t now, unsigned *n, uint32_t *sum, uint32_t *max){
+  uint32_t dt = now - since;
+
+  (*n)++;
+  *sum += dt;
+  if (dt > *max){
+    *max = dt;
+  }
+  if (verbose){
+    printf("%8u   %s ao evento da linha %d: %u ms\n", now, what, line, dt);
+  }
+}
+
+/* Envia os caracteres que cabem num ms e procura a resposta  ltima trama */
+static void drain_tx (uint32_t now){
+  int i, c;
+
+  for (i = 0; i < SIM_TX_PER_MS && (c = sim_tx_get()) >= 0; i++){
+    tx_count++;
+    if (show_tx){
+      if ((c >= ' ' && c < 0x7F) || '\n' == c){
+        putchar(c);
+      }
+      else {
+        printf("\\x%02x", c);
+      }
+    }
+    memmove(tx_window, tx_window + 1, sizeof(tx_window) - 1);
+    tx_window[sizeof(tx_window) - 1] = c;
+    if (reply_line && PROTO_SOF_REPLY == tx_window[0] && reply_seq == tx_window[3]){
+      latency("resposta", reply_line, reply_time, now, &reply_n, &reply_sum, &reply_max);
+      reply_line = 0;
+      reply_len = tx_window[2];
+    }
+  }
+}
+
+/* Corre o trace carregado e devolve o nmero de verificaes falhadas */
+static unsigned run (void){
+  uint32_t now;
+  int next = 0;
+  int first;
+  uint8_t last_state;
+  uint8_t last_motor = OUT_OFF;
+  uint16_t h, p;
+
+  motor_init();
+  usart_init(); // Como main() (velocidade da porta srie guardada em EEPROM)
+  supervisor_init(FAULT_NONE); // (o watchdog da simulao no faz nada)
+  controller_init();
+  last_state = state;
+  if (verbose){
+    printf("%8u estado %s\n", 0, state_name(state));
+  }
+
+  for (now = 0; now <= end_time; now++){
+    int i;
+    uint8_t motor;
+
+    first = next;
+    while (next < event_count && events[next].t == now){ // Entradas deste ms
+      apply_input(&events[next++], now);
+    }
+    for (i = 0; i < SIM_RX_PER_MS && rx_queue_tail != rx_queue_head; i++){
+      uint8_t c = rx_queue[rx_queue_tail++ % SIM_RX_QUEUE];
+
+      rx_put(baud_match() ? c : 0x00); // A uma velocidade errada s chega lixo
+    }
+
+    for (i = 0; sim_adc && i < SIM_ADC_PER_MS; i++){ // "ISR" do ADC (s com CURRENT_SENSE o ADC  ligado)
+      current_sample(plant_current());
+    }
+    controller_tick();
+    plant_step();
+    drain_tx(now);
+    for (i = 0; i < SIM_POLL_MAX && controller_poll(); i++){
+    }
+
+    motor = motor_outputs();
+    if (state != last_state || motor != last_motor){
+      if (verbose && state != last_state){
+        printf("%8u estado %s -> %s (altura %u, persiana %u)\n", now, state_name(last_state), state_name(state), position_height(), plant_height());
+      }
+      if (verbose && motor != last_motor){
+        printf("%8u motor %s\n", now, motor_names[motor]);
+      }
+      if (react_line){
+        latency("reao", react_line, react_time, now, &react_n, &react_sum, &react_max);
+        react_line = 0;
+      }
+      last_state = state;
+      last_motor = motor;
+    }
+
+    for (i = first; i < next; i++){ // Verificaes deste ms
+      check(&events[i], now);
+    }
+  }
+
+  h = position_height();
+  p = plant_height();
+  if (verbose || failures){
+    printf("%s: %u ms, estado %s, altura %u (persiana %u, erro %d), inverses bruscas %u, %lu caracteres enviados\n",
+      trace_name, end_time, state_name(state), h, p, (int)h - (int)p, plant_reversals, tx_count);
+    if (react_n){
+      printf("  latncia da reao: %u eventos, mdia %.1f ms, mxima %u ms\n", react_n, (double)react_sum / react_n, react_max);
+    }
+    if (reply_n){
+      printf("  latncia da resposta: %u tramas, mdia %.1f ms, mxima %u ms\n", reply_n, (double)reply_sum / reply_n, reply_max);
+    }
+  }
+  printf("%s: %u/%u verificaes %s\n", trace_name, checks - failures, checks, failures ? "FALHARAM" : "ok");
+  return failures;
+}
+
+int main (int argc, char **argv){
+  int repeat = 1;
+  int opt;
+  int i, r;
+  int failed = 0;
+  struct timespec t0, t1;
+  double elapsed;
+
+  while ((opt = getopt(argc, argv, "vtr:")) != -1){
+    if ('v' == opt){
+      verbose = 1;
+    }
+    else if ('t' == opt){
+      show_tx = 1;
+    }
+    else if ('r' == opt && atoi(optarg) > 0){
+      repeat = atoi(optarg);
+    }
+    else {
+      fprintf(stderr, "utilizao: %s [-v] [-t] [-r N] trace...\n", argv[0]);
+      return 2;
+    }
+  }
+  if (optind == argc){
+    fprintf(stderr, "utilizao: %s [-v] [-t] [-r N] trace...\n", argv[0]);
+    return 2;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = optind; i < argc; i++){
+    for (r = 0; r < repeat; r++){
+      pid_t pid;
+      int status;
+
+      fflush(stdout);
+      pid = fork();
+      if (pid < 0){
+        perror("fork");
+        return 2;
+      }
+      if (0 == pid){ // Cada cenrio corre num processo novo (globais com os valores iniciais)
+        trace_name = argv[i];
+        if (r){ // S a primeira repetio mostra resultados
+          verbose = 0;
+          show_tx = 0;
+          if (!freopen("/dev/null", "w", stdout)){
+            _exit(2);
+          }
+        }
+        load_trace(argv[i]);
+        exit(run() ? 1 : 0);
+      }
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status)){
+        failed = 1;
+        if (!WIFEXITED(status) || 1 != WEXITSTATUS(status)){
+          printf("%s: simulao terminou com erro\n", argv[i]);
+        }
+        break;
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (repeat > 1){
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d cenrios em %.3f s (%.0f cenrios/s)\n", (argc - optind) * repeat, elapsed, (argc - optind) * repeat / elapsed);
+  }
+  return failed;
+}
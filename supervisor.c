@@ -0,0 +1,94 @@
+/*
+ * supervisor.c
+ *  Watchdog, tempo mximo de cada movimento e registo de falhas
+ *  (ver supervisor.h)
+ *
+ *  O nmero total de falhas (ee_sup_count) indica o registo a usar a
+ *  seguir; uma EEPROM apagada (0xFFFF) corresponde a nenhuma falha.
+ *  As escritas so feitas logo (cada byte demora cerca de 3.4ms, bem
+ *  abaixo do prazo do watchdog): as falhas so raras, e um reset
+ *  pouco depois no as deve perder.
+ */
+
+#include "supervisor.h"
+#include "clock.h"
+
+static sup_fault_t EEMEM ee_sup_log[SUP_LOG]; // Registos das falhas
+static uint16_t EEMEM ee_sup_count = 0xFFFF; // Nmero de falhas registadas
+
+volatile uint16_t sup_run_ms = 0;
+volatile uint16_t sup_run_limit = 0xFFFF;
+volatile uint8_t sup_tripped = 0;
+
+/* Nmero de falhas registadas */
+static uint16_t fault_count (void){
+  uint16_t count = eeprom_read_word(&ee_sup_count);
+
+  return (0xFFFF == count) ? 0 : count;
+}
+
+/* Regista a causa do reset (FAULT_NONE num arranque normal) e liga o
+ * watchdog. Chamada antes de controller_init() */
+void supervisor_init (uint8_t reset_fault){
+  if (FAULT_NONE != reset_fault){
+    supervisor_log(reset_fault, 0xFF, 0xFFFF); // (estado e altura desconhecidos depois do reset)
+  }
+  hal_wdt_init();
+}
+
+/* Comea um movimento com um tempo mximo de motor ligado de "limit" ms */
+void supervisor_arm (uint16_t limit){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // Valores de 16 bits tambm usados pela ISR
+    sup_run_ms = 0;
+    sup_run_limit = limit;
+  }
+}
+
+/* Alimenta o watchdog (em cada passagem pelo ciclo principal).
+ * Devolve FAULT_RUNTIME se a ISR desligou o motor desde a ltima
+ * chamada, seno FAULT_NONE */
+uint8_t supervisor_poll (void){
+  hal_wdt_reset();
+  if (sup_tripped){
+    sup_tripped = 0;
+    return FAULT_RUNTIME;
+  }
+  return FAULT_NONE;
+}
+
+/* Guarda uma falha em EEPROM */
+void supervisor_log (uint8_t code, uint8_t state, uint16_t height){
+  uint16_t count = fault_count();
+  sup_fault_t last;
+  sup_fault_t entry;
+
+  if (count){
+    eeprom_read_block(&last, &ee_sup_log[(count - 1) % SUP_LOG], sizeof(last));
+    if (last.code == code && last.state == state){ // Repetio da ltima falha
+      if (last.repeats != 0xFF){
+        eeprom_update_byte(&ee_sup_log[(count - 1) % SUP_LOG].repeats, last.repeats + 1);
+      }
+      return;
+    }
+  }
+
+  entry.code = code;
+  entry.state = state;
+  entry.height = height;
+  entry.uptime = millis();
+  entry.repeats = 1;
+  eeprom_update_block(&entry, &ee_sup_log[count % SUP_LOG], sizeof(entry));
+  count = (0xFFFE == count) ? SUP_LOG + 0xFFFF % SUP_LOG : count + 1; // (nunca chega a 0xFFFF, apagada, e continua no registo seguinte)
+  eeprom_update_word(&ee_sup_count, count);
+}
+
+/* L a falha "n" (0  a mais recente). Devolve 0 se no existir */
+uint8_t supervisor_fault (uint8_t n, sup_fault_t *fault){
+  uint16_t count = fault_count();
+
+  if (n >= SUP_LOG || n >= count){
+    return 0;
+  }
+  eeprom_read_block(fault, &ee_sup_log[(count - 1 - n) % SUP_LOG], sizeof(*fault));
+  return 1;
+}
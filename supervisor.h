@@ -0,0 +1,79 @@
+/*
+ * supervisor.h
+ *  Watchdog, tempo mximo de cada movimento e registo de falhas
+ *
+ *  Trs protees, para que um n nunca fique parado  espera de
+ *  algum que lhe desligue a alimentao:
+ *   -O watchdog do AVR  ligado no arranque e s  alimentado no
+ *  ciclo principal (supervisor_poll()). Um ciclo bloqueado (ou com
+ *  as interrupes desligadas) faz reset ao fim de 250ms; como a
+ *  altura guardada  invalidada sempre que o motor liga, um reset a
+ *  meio de um movimento obriga a nova inicializao.
+ *   -Em cada movimento (cada entrada num estado)  armado um tempo
+ *  mximo de motor ligado (supervisor_arm()), contado a cada ms pela
+ *  ISR do timer 2. Se for excedido a prpria ISR desliga o motor,
+ *  mesmo que o ciclo principal no responda, e o ciclo principal
+ *  trata a falha.
+ *   -As falhas so guardadas em EEPROM (SUP_LOG registos, usados
+ *  rotativamente) com o estado, a altura e o instante em que
+ *  aconteceram, para serem lidas pelo computador (CMD_GET_FAULT). Uma
+ *  falha igual  ltima (mesmo cdigo e estado) apenas incrementa o
+ *  nmero de repeties desta, que satura em 255, para que um ciclo
+ *  de resets no gaste a EEPROM.
+ *  Depois de uma falha o controlador volta a inicializar a persiana
+ *  (estado INIT), no mximo SUP_REHOME_MAX vezes seguidas; s ento
+ *  fica parado no estado ILLEGAL, de onde sai com um boto ou um
+ *  comando.
+ */
+
+#ifndef SUPERVISOR_H_
+#define SUPERVISOR_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+#define SUP_LOG 8 // Registos de falhas em EEPROM
+#define SUP_REHOME_MAX 3 // Reinicializaes seguidas depois de falhas, antes de desistir
+
+// Cdigos de falha
+#define FAULT_NONE 0 // Sem falha (registo vazio)
+#define FAULT_WATCHDOG 1 // Reset pelo watchdog (ciclo principal bloqueado)
+#define FAULT_BROWNOUT 2 // Reset por falha da alimentao (brown-out)
+#define FAULT_RUNTIME 3 // Motor ligado para alm do tempo mximo do movimento
+#define FAULT_STATE 4 // Estado imprevisto (o registo guarda o valor do estado)
+#define FAULT_STALL 5 // Motor bloqueado longe dos limites do percurso (obstculo, ver current.h)
+#define FAULT_ROLLBACK 6 // Uma imagem nova da firmware falhou e o bootloader voltou  anterior (ver update.h)
+
+typedef struct {
+  uint8_t code; // Cdigo da falha (FAULT_*)
+  uint8_t state; // Estado em que aconteceu
+  uint16_t height; // Altura estimada nesse momento
+  uint32_t uptime; // ms desde o arranque (da primeira ocorrncia)
+  uint8_t repeats; // Ocorrncias seguidas iguais (satura em 255)
+} sup_fault_t;
+
+extern volatile uint16_t sup_run_ms; // ms de motor ligado no movimento atual
+extern volatile uint16_t sup_run_limit; // Tempo mximo de motor ligado no movimento atual
+extern volatile uint8_t sup_tripped; // O tempo mximo foi excedido (escrito pela ISR)
+
+void supervisor_init(uint8_t reset_fault);
+void supervisor_arm(uint16_t limit);
+uint8_t supervisor_poll(void);
+void supervisor_log(uint8_t code, uint8_t state, uint16_t height);
+uint8_t supervisor_fault(uint8_t n, sup_fault_t *fault);
+
+/* Conta o tempo de motor ligado (s deve ser chamada pela ISR do
+ * timer 2). Devolve 1 no ms em que o tempo mximo  excedido */
+static inline uint8_t supervisor_tick (uint8_t motor){
+  if (!motor){
+    return 0;
+  }
+  if (sup_run_ms < sup_run_limit){
+    sup_run_ms++;
+    return 0;
+  }
+  sup_tripped = 1;
+  return 1;
+}
+
+#endif /* SUPERVISOR_H_ */
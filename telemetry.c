@@ -0,0 +1,73 @@
+/*
+ * telemetry.c
+ *  Telemetria binria: registos de tamanho fixo com o estado da
+ *  persiana, enviados pelo buffer de transmisso (sem printf)
+ *
+ *  O main() chama telemetry_sample() em cada iterao com o instante
+ *  e o estado atuais;  enviado um registo sempre que passou o
+ *  perodo configurado desde o ltimo (e, no modo TLM_ON_CHANGE, se
+ *  o estado, a altura ou as entradas/sadas mudaram). Cada registo 
+ *  colocado de uma s vez no buffer de transmisso, ou descartado
+ *  inteiro se no couber, para que o computador nunca receba
+ *  registos cortados.
+ */
+
+#include "hal.h"
+#include "telemetry.h"
+#include "serial.h"
+#include "bus.h"
+
+uint8_t telemetry_on = 0;
+
+static uint16_t period = 0; // Intervalo mnimo entre registos (ms)
+static uint8_t mode = 0; // Bits TLM_ON_CHANGE
+static uint16_t last_ms; // Instante do ltimo registo enviado
+static uint8_t last_state; // Contedo do ltimo registo enviado (para o modo TLM_ON_CHANGE)
+static uint16_t last_height;
+static uint8_t last_io;
+
+/* Configura o perodo (0 desliga) e o modo da telemetria.
+ * Devolve 0 se for pedida numa linha partilhada (ver telemetry.h) */
+uint8_t telemetry_configure (uint16_t new_period, uint8_t new_mode){
+  if (BUS_MODE != BUS_P2P && new_period){
+    return 0;
+  }
+  period = new_period;
+  mode = new_mode;
+  telemetry_on = (0 != new_period);
+  last_state = 0xFF; // Fora o envio do primeiro registo
+  return 1;
+}
+
+/* Envia um registo, se for altura disso */
+void telemetry_sample (uint16_t ms, uint8_t sub, uint8_t state, uint16_t height, uint8_t io){
+  uint8_t record[TLM_RECORD_SIZE];
+  uint8_t crc = 0;
+  uint8_t i;
+
+  if (!telemetry_on || (uint16_t)(ms - last_ms) < period){
+    return;
+  }
+  if ((mode & TLM_ON_CHANGE) && state == last_state && height == last_height && io == last_io){
+    return;
+  }
+
+  record[0] = TLM_SOF;
+  record[1] = ms & 0xFF;
+  record[2] = ms >> 8;
+  record[3] = sub;
+  record[4] = state;
+  record[5] = height & 0xFF;
+  record[6] = height >> 8;
+  record[7] = io;
+  for (i = 1; i < TLM_RECORD_SIZE-1; i++){
+    crc = _crc8_ccitt_update(crc, record[i]);
+  }
+  record[TLM_RECORD_SIZE-1] = crc;
+
+  usart_tx_write(record, TLM_RECORD_SIZE);
+  last_ms = ms;
+  last_state = state;
+  last_height = height;
+  last_io = io;
+}
@@ -0,0 +1,42 @@
+/*
+ * telemetry.h
+ *  Telemetria binria: registos de tamanho fixo com o estado da
+ *  persiana, enviados pelo buffer de transmisso (sem printf)
+ *
+ *  Formato de um registo (TLM_RECORD_SIZE bytes, little-endian):
+ *   SOF | MS[2] | SUB | STATE | HEIGHT[2] | IO | CRC
+ *    SOF    - TLM_SOF (diferente do incio das tramas do protocolo)
+ *    MS     - 16 bits menos significativos do instante em ms
+ *    SUB    - frao do ms em contagens do timer 2 (8us cada)
+ *    STATE  - estado da mquina de estados
+ *    HEIGHT - altura atual
+ *    IO     - bits TLM_IO_* (motor, direo e botes)
+ *    CRC    - CRC-8 (polinmio 0x07) dos bytes entre SOF e CRC
+ *
+ *  S existe na ligao ponto-a-ponto (BUS_P2P): numa linha RS-485
+ *  partilhada os registos, enviados sem serem pedidos, colidiriam
+ *  com as respostas dos outros ns e com as tramas do computador.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#define TLM_SOF 0xA6 // Incio de registo de telemetria
+#define TLM_RECORD_SIZE 9 // Tamanho de um registo
+
+#define TLM_ON_CHANGE 0x01 // Modo: s envia registos quando algo mudou
+
+// Bits do campo IO
+#define TLM_IO_MOTOR 0x01 // Motor ligado
+#define TLM_IO_DIR 0x02 // Direo para cima
+#define TLM_IO_OPEN 0x04 // Boto de abertura premido
+#define TLM_IO_CLOSE 0x08 // Boto de fecho premido
+
+extern uint8_t telemetry_on; // Telemetria ativa (perodo diferente de 0)
+
+uint8_t telemetry_configure(uint16_t period, uint8_t mode);
+void telemetry_sample(uint16_t ms, uint8_t sub, uint8_t state, uint16_t height, uint8_t io);
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,64 @@
+/*
+ * timer.c
+ *  Temporizadores por software (lista de deltas) avanados pela
+ *  interrupo do timer 2, a cada ms (ver timer.h)
+ */
+
+#include "hal.h"
+#include "timer.h"
+
+volatile uint8_t timer_events = 0;
+volatile uint8_t tmr_head = TMR_NONE;
+uint8_t tmr_next[TIMERS];
+uint16_t tmr_delta[TIMERS];
+
+/* Retira um temporizador da lista, se estiver armado (com as interrupes desligadas) */
+static void unlink (uint8_t id){
+  uint8_t *link = (uint8_t *)&tmr_head;
+
+  while (TMR_NONE != *link){
+    if (id == *link){
+      *link = tmr_next[id];
+      if (TMR_NONE != *link){ // O seguinte passa a contar tambm o tempo deste
+        tmr_delta[*link] += tmr_delta[id];
+      }
+      return;
+    }
+    link = &tmr_next[*link];
+  }
+}
+
+/* Arma (ou rearma) um temporizador para expirar daqui a "ms" ms.
+ * Com ms a 0 expira imediatamente */
+void timer_start (uint8_t id, uint16_t ms){
+  uint8_t *link = (uint8_t *)&tmr_head;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){ // A ISR tambm altera a lista
+    unlink(id);
+    if (!ms){
+      timer_events |= 1 << id;
+    }
+    else {
+      timer_events &= ~(1 << id);
+
+      while (TMR_NONE != *link && tmr_delta[*link] <= ms){ // Procura a posio, descontando os que expiram antes
+        ms -= tmr_delta[*link];
+        link = &tmr_next[*link];
+      }
+      tmr_next[id] = *link;
+      tmr_delta[id] = ms;
+      if (TMR_NONE != *link){ // O seguinte passa a contar a partir deste
+        tmr_delta[*link] -= ms;
+      }
+      *link = id;
+    }
+  }
+}
+
+/* Desarma um temporizador (sem o dar como expirado) */
+void timer_stop (uint8_t id){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    unlink(id);
+    timer_events &= ~(1 << id);
+  }
+}
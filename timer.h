@@ -0,0 +1,67 @@
+/*
+ * timer.h
+ *  Temporizadores por software (lista de deltas) avanados pela
+ *  interrupo do timer 2, a cada ms
+ *
+ *  Os temporizadores armados formam uma lista ordenada pelo instante
+ *  em que expiram, em que cada um guarda apenas os ms que faltam
+ *  depois do anterior. A ISR s decrementa o primeiro da lista, pelo
+ *  que o custo por ms no depende de quantos esto armados; quando
+ *  este chega a 0  retirado, junto com os que expiram no mesmo ms
+ *  (delta 0). Armar ou desarmar percorre a lista (no mximo TIMERS
+ *  elementos), fora da ISR.
+ *  A ISR no executa nada quando um temporizador expira: apenas
+ *  marca o respetivo bit em timer_events, que o ciclo principal
+ *  consulta com timer_expired().
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+
+// Temporizadores (bit respetivo em timer_events)
+#define TMR_CLICK 0 // Deciso entre clique rpido e lento (CLOSE_CHECK/OPEN_CHECK)
+#define TMR_INIT 1 // Tempo mximo da inicializao
+#define TMR_BAUD 2 // Prazo para confirmar uma nova velocidade da porta srie (baud.c)
+#define TMR_REPLY 3 // Janela da resposta a uma trama para um grupo ou para todos (protocol.c)
+#define TMR_UPDATE 4 // Confirmao de uma imagem nova e reset depois de CMD_FW_COMMIT (update.c)
+#define TIMERS 5 // Nmero de temporizadores (no mximo 8)
+
+#define TMR_NONE 0xFF // Fim da lista
+
+#if TIMERS > 8
+#error "timer_events s tem 8 bits"
+#endif
+
+extern volatile uint8_t timer_events; // Temporizadores que expiraram (bit a 1)
+extern volatile uint8_t tmr_head; // Primeiro temporizador da lista (o prximo a expirar)
+extern uint8_t tmr_next[TIMERS]; // Temporizador seguinte na lista
+extern uint16_t tmr_delta[TIMERS]; // ms depois do temporizador anterior
+
+void timer_start(uint8_t id, uint16_t ms);
+void timer_stop(uint8_t id);
+
+/* O temporizador expirou (e no voltou a ser armado desde ento) */
+static inline uint8_t timer_expired (uint8_t id){
+  return (timer_events >> id) & 1;
+}
+
+/* Avana os temporizadores 1ms (s deve ser chamada pela ISR do timer 2) */
+static inline void timer_tick (void){
+  uint8_t id = tmr_head;
+
+  if (TMR_NONE == id){
+    return;
+  }
+  if (--tmr_delta[id]){
+    return;
+  }
+  do { // Retira o primeiro e todos os que expiram no mesmo ms
+    timer_events |= 1 << id;
+    id = tmr_next[id];
+  } while (TMR_NONE != id && !tmr_delta[id]);
+  tmr_head = id;
+}
+
+#endif /* TIMER_H_ */
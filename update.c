@@ -0,0 +1,310 @@
+/*
+ * update.c
+ *  Atualizao da firmware por tramas (ver update.h)
+ *
+ *  As pginas j escritas (e verificadas) da sesso em curso so
+ *  marcadas num mapa de bits, em RAM e em EEPROM, para que uma
+ *  sesso interrompida (perda de tramas, reset, corte de energia)
+ *  continue onde ficou: o computador s tem de reenviar as pginas
+ *  que CMD_FW_STATUS d como em falta. Os blocos de uma pgina so
+ *  juntos em page_buf at estarem todos (page_mask); a pgina  ento
+ *  escrita pelo bootloader e comparada com page_buf.
+ */
+
+#include <string.h>
+#include "hal.h"
+#include "update.h"
+#include "protocol.h"
+#include "serial.h"
+#include "timer.h"
+#include "bus.h"
+
+#define UPDATE_MAP (BOOT_PAGES / 8) // Bytes do mapa de pginas escritas
+
+typedef struct {
+  uint8_t slot; // Slot da imagem em receo (BOOT_NONE se no h sesso)
+  uint16_t size; // Tamanho da imagem (bytes)
+  uint16_t crc; // CRC-16 da imagem
+  uint8_t written[UPDATE_MAP]; // Pginas j escritas (bit a 1)
+} update_session_t;
+
+#if BOOTLOADER
+static update_session_t EEMEM ee_update = {BOOT_NONE, 0, 0, {0}}; // Sesso guardada em EEPROM
+static update_session_t upd; // Sesso em curso
+static uint16_t page_index = 0xFFFF; // Pgina em page_buf (0xFFFF nenhuma)
+static uint8_t page_mask; // Blocos da pgina j recebidos (bit a 1)
+static uint8_t page_buf[BOOT_PAGE_SIZE]; // Pgina em receo
+static uint8_t upd_open = 0; // CMD_FW_BEGIN aceite: os blocos so desta sesso
+static uint8_t upd_trial = 0; // A imagem em execuo ainda no se confirmou
+static uint8_t upd_reboot = 0; // Reset pedido por CMD_FW_COMMIT (depois da resposta)
+
+/* L o registo de arranque. Devolve 0 se estiver apagado ou corrompido */
+static uint8_t record_read (boot_record_t *rec){
+  eeprom_read_block(rec, hal_boot_record(), sizeof(*rec));
+  return rec->check == boot_record_check(rec) && rec->active <= 1;
+}
+
+/* Escreve o registo de arranque (com o CRC) */
+static void record_write (boot_record_t *rec){
+  rec->check = boot_record_check(rec);
+  eeprom_update_block(rec, hal_boot_record(), sizeof(*rec));
+}
+
+/* Nmero de pginas da imagem em receo */
+static uint16_t session_pages (void){
+  return (upd.size + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+}
+
+/* A pgina j foi escrita nesta sesso */
+static uint8_t page_written (uint16_t page){
+  return (upd.written[page >> 3] >> (page & 7)) & 1;
+}
+
+/* Blocos que uma pgina da imagem tem de receber (a ltima pode ser
+ * incompleta; o resto dela fica apagado, a 0xFF) */
+static uint8_t page_blocks (uint16_t page){
+  uint16_t left = upd.size - page * BOOT_PAGE_SIZE;
+  uint8_t n = (left >= BOOT_PAGE_SIZE) ? UPDATE_BLOCKS_PER_PAGE : (left + UPDATE_BLOCK - 1) / UPDATE_BLOCK;
+
+  return (1 << n) - 1;
+}
+
+/* Escreve a pgina completa em page_buf e, se conferir, marca-a */
+static void page_flush (void){
+  uint16_t addr = boot_slot_base(upd.slot) + page_index * BOOT_PAGE_SIZE;
+  uint8_t i;
+
+  hal_flash_write(addr, page_buf); // (cerca de 9ms sem interrupes)
+  for (i = 0; i < BOOT_PAGE_SIZE; i++){
+    if (hal_flash_read(addr + i) != page_buf[i]){ // No ficou escrita: continua em falta
+      return;
+    }
+  }
+  upd.written[page_index >> 3] |= 1 << (page_index & 7);
+  eeprom_update_byte(&ee_update.written[page_index >> 3], upd.written[page_index >> 3]);
+}
+#endif
+
+/* Retoma a sesso guardada em EEPROM e verifica se a imagem em
+ * execuo  nova (ainda por confirmar) */
+void update_init (void){
+#if BOOTLOADER
+  boot_record_t rec;
+
+  eeprom_read_block(&upd, &ee_update, sizeof(upd));
+  if (upd.slot > 1 || upd.slot == hal_boot_slot() || upd.size > BOOT_SLOT_SIZE){ // Sem sesso, ou j  a imagem em execuo
+    upd.slot = BOOT_NONE;
+  }
+  if (record_read(&rec) && rec.trial == hal_boot_slot()){ // Primeiros arranques de uma imagem nova
+    upd_trial = 1;
+    timer_start(TMR_UPDATE, UPDATE_CONFIRM_TIME);
+  }
+#endif
+}
+
+/* CMD_FW_BEGIN: abre (ou retoma) a sesso de uma imagem para o slot
+ * "slot", com "size" bytes e CRC-16 "crc" */
+uint8_t update_begin (uint8_t slot, uint16_t size, uint16_t crc){
+#if BOOTLOADER
+  boot_record_t rec;
+  uint8_t i;
+
+  upd_open = 0; // Os blocos que se seguem so de outra imagem at ser aceite
+  page_index = 0xFFFF;
+  if (upd_trial || upd_reboot || slot == hal_boot_slot()){ // Imagem atual por confirmar, ou seria escrita por cima de si prpria
+    return ERR_BUSY;
+  }
+  if (slot > 1 || !size || size > BOOT_SLOT_SIZE){
+    return ERR_RANGE;
+  }
+  upd_open = 1;
+  if (slot == upd.slot && size == upd.size && crc == upd.crc){ // A mesma imagem: continua onde ficou
+    return 0;
+  }
+
+  if (!record_read(&rec)){ // (o bootloader usa os mesmos valores, exceto o slot confirmado:  o que est a correr)
+    rec.active = hal_boot_slot();
+    rec.trial = BOOT_NONE;
+    rec.tries = 0;
+    rec.size[0] = rec.size[1] = BOOT_SIZE_UNKNOWN;
+    rec.crc[0] = rec.crc[1] = 0;
+  }
+  rec.size[slot] = 0; // O slot vai ficar com uma imagem incompleta: invlido para o bootloader
+  rec.trial = BOOT_NONE;
+  record_write(&rec);
+
+  upd.slot = slot;
+  upd.size = size;
+  upd.crc = crc;
+  for (i = 0; i < UPDATE_MAP; i++){
+    upd.written[i] = 0;
+  }
+  eeprom_update_block(&upd, &ee_update, sizeof(upd));
+  return 0;
+#else
+  (void)slot; (void)size; (void)crc;
+  return ERR_BUSY;
+#endif
+}
+
+/* CMD_FW_BLOCK: recebe o bloco "index" da imagem (UPDATE_BLOCK bytes
+ * em "data", com CRC-16 "crc") */
+uint8_t update_block (uint16_t index, uint16_t crc, const uint8_t *data){
+#if BOOTLOADER
+  uint16_t page = index / UPDATE_BLOCKS_PER_PAGE;
+  uint8_t bit = 1 << (index % UPDATE_BLOCKS_PER_PAGE);
+  uint16_t check = 0xFFFF;
+  uint8_t i;
+
+  if (!upd_open){
+    return ERR_BUSY;
+  }
+  if (page >= session_pages() || !(page_blocks(page) & bit)){ // Para l do fim da imagem
+    return ERR_RANGE;
+  }
+  for (i = 0; i < UPDATE_BLOCK; i++){
+    check = _crc16_update(check, data[i]);
+  }
+  if (check != crc){
+    return ERR_CRC;
+  }
+  if (page_written(page)){ // Reenvio de uma pgina que este n j tem
+    return 0;
+  }
+
+  if (page != page_index){ // Comea outra pgina (a anterior, se incompleta, fica em falta)
+    page_index = page;
+    page_mask = 0;
+    for (i = 0; i < BOOT_PAGE_SIZE; i++){
+      page_buf[i] = 0xFF;
+    }
+  }
+  memcpy(&page_buf[(index % UPDATE_BLOCKS_PER_PAGE) * UPDATE_BLOCK], data, UPDATE_BLOCK);
+  page_mask |= bit;
+  if (page_mask == page_blocks(page)){
+    page_flush();
+    page_index = 0xFFFF;
+  }
+  return 0;
+#else
+  (void)index; (void)crc; (void)data;
+  return ERR_BUSY;
+#endif
+}
+
+/* CMD_FW_STATUS: responde com o slot em execuo, o nmero de pginas
+ * em falta e o mapa das pginas "first"~"first"+UPDATE_STATUS_PAGES-1
+ * (bit a 1 -> em falta) */
+uint8_t update_status (uint8_t first){
+#if BOOTLOADER
+  uint16_t pages = (BOOT_NONE == upd.slot) ? 0 : session_pages();
+  uint16_t missing = 0;
+  uint16_t page;
+  uint8_t *map;
+  uint8_t i;
+
+  if (first & 7){ // O mapa comea num byte inteiro
+    return ERR_RANGE;
+  }
+  for (page = 0; page < pages; page++){
+    missing += !page_written(page);
+  }
+  protocol_reply_u8(hal_boot_slot());
+  protocol_reply_u16(missing);
+  map = protocol_reply_reserve(UPDATE_STATUS_PAGES / 8);
+  if (!map){
+    return ERR_FULL;
+  }
+  for (i = 0; i < UPDATE_STATUS_PAGES / 8; i++){
+    uint8_t bits = 0;
+    uint8_t j;
+
+    for (j = 0; j < 8; j++){
+      page = first + i * 8 + j;
+      if (page < pages && !page_written(page)){
+        bits |= 1 << j;
+      }
+    }
+    map[i] = bits;
+  }
+  return 0;
+#else
+  (void)first;
+  return ERR_BUSY;
+#endif
+}
+
+/* CMD_FW_COMMIT: verifica a imagem recebida e marca-a para experincia
+ * no prximo arranque (o reset  feito depois da resposta) */
+uint8_t update_commit (void){
+#if BOOTLOADER
+  boot_record_t rec;
+  uint16_t check = 0xFFFF;
+  uint16_t base;
+  uint16_t i;
+
+  if (!upd_open){
+    return ERR_BUSY;
+  }
+  for (i = 0; i < session_pages(); i++){
+    if (!page_written(i)){
+      return ERR_VERIFY;
+    }
+  }
+  base = boot_slot_base(upd.slot);
+  for (i = 0; i < upd.size; i++){ // (cerca de 15ms para uma imagem completa)
+    check = _crc16_update(check, hal_flash_read(base + i));
+  }
+  if (check != upd.crc){
+    return ERR_VERIFY;
+  }
+
+  if (!record_read(&rec)){
+    rec.active = !upd.slot;
+    rec.size[!upd.slot] = BOOT_SIZE_UNKNOWN;
+    rec.crc[!upd.slot] = 0;
+  }
+  rec.trial = upd.slot;
+  rec.tries = BOOT_TRIES;
+  rec.size[upd.slot] = upd.size;
+  rec.crc[upd.slot] = upd.crc;
+  record_write(&rec);
+
+  upd.slot = BOOT_NONE; // A sesso terminou
+  upd_open = 0;
+  eeprom_update_byte(&ee_update.slot, BOOT_NONE);
+  upd_reboot = 1;
+  timer_start(TMR_UPDATE, bus_offset() + BUS_SLOT_TIME); // D tempo  resposta na janela deste n
+  return 0;
+#else
+  return ERR_BUSY;
+#endif
+}
+
+/* Faz o reset pedido por CMD_FW_COMMIT, depois de a resposta sair, e
+ * confirma a imagem em execuo ao fim de UPDATE_CONFIRM_TIME ms
+ * (chamada no ciclo principal) */
+void update_poll (void){
+#if BOOTLOADER
+  boot_record_t rec;
+
+  if (!timer_expired(TMR_UPDATE)){
+    return;
+  }
+  if (upd_reboot){
+    if (usart_tx_idle()){
+      upd_reboot = 0;
+      hal_reset();
+    }
+  }
+  else if (upd_trial){ // A imagem nova chegou at aqui: passa a ser a confirmada
+    upd_trial = 0;
+    if (record_read(&rec) && rec.trial == hal_boot_slot()){
+      rec.active = rec.trial;
+      rec.trial = BOOT_NONE;
+      record_write(&rec);
+    }
+    timer_stop(TMR_UPDATE);
+  }
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+ * update.h
+ *  Atualizao da firmware por tramas, para muitos ns de uma vez
+ *  (com o bootloader A/B, ver boot/boot.h)
+ *
+ *  A imagem nova  escrita no slot que no est em execuo,
+ *  enquanto a firmware atual continua a funcionar:
+ *   1. CMD_FW_BEGIN (por difuso) abre a sesso com o slot para que a
+ *      imagem foi ligada, o tamanho e o CRC-16 da imagem. Um n que
+ *      est a correr nesse slot recusa-a e ignora os blocos que se
+ *      seguem (o computador envia depois a imagem do outro slot a
+ *      esses ns, da mesma forma). Uma sesso com o mesmo
+ *      slot, tamanho e CRC que a anterior continua onde esta ficou,
+ *      mesmo depois de um reset: as pginas j escritas esto
+ *      marcadas em EEPROM.
+ *   2. CMD_FW_BLOCK (por difuso, sem resposta) envia cada bloco de
+ *      UPDATE_BLOCK bytes, com o seu CRC-16. Os blocos de uma pgina
+ *      juntam-se em RAM e a pgina  escrita (e lida de volta) quando
+ *      est completa; um bloco de outra pgina descarta a pgina
+ *      incompleta, que o n dar como em falta. Depois de cada pgina
+ *      o computador tem de esperar UPDATE_PAGE_TIME ms, o tempo em que
+ *      o n est a escrever com as interrupes desligadas.
+ *   3. CMD_FW_STATUS (a cada n) devolve as pginas em falta, que o
+ *      computador volta a enviar a todos de uma vez.
+ *   4. CMD_FW_COMMIT (a cada n) verifica o CRC da imagem completa,
+ *      marca-a para experincia no registo de arranque e faz reset
+ *      depois de a resposta sair (numa linha RS-485, depois de o n
+ *      largar a linha, ver usart_tx_idle()). A imagem nova confirma-se a si prpria ao
+ *      fim de UPDATE_CONFIRM_TIME ms a correr; se no chegar l em
+ *      BOOT_TRIES arranques, o bootloader volta  anterior.
+ *  Os blocos s so aceites com a persiana parada (IDLE): a escrita
+ *  de uma pgina atrasa a ISR do timer 2 e a receo.
+ *  Sem o bootloader (firmware compilada sem SLOT, BOOTLOADER a 0) os
+ *  comandos respondem ERR_BUSY.
+ */
+
+#ifndef UPDATE_H_
+#define UPDATE_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+#ifndef BOOTLOADER
+#define BOOTLOADER 0 // Firmware gravada sozinha, sem o bootloader
+#endif
+
+#define UPDATE_BLOCK 16 // Bytes de imagem por CMD_FW_BLOCK
+#define UPDATE_BLOCKS_PER_PAGE (BOOT_PAGE_SIZE / UPDATE_BLOCK) // Blocos por pgina (8, um byte de mscara)
+#define UPDATE_STATUS_PAGES 64 // Pginas descritas por cada CMD_FW_STATUS
+#define UPDATE_PAGE_TIME 12 // ms que o computador espera depois de completar uma pgina
+#define UPDATE_CONFIRM_TIME 10000 // ms a correr at uma imagem nova se confirmar
+
+#if UPDATE_BLOCKS_PER_PAGE != 8
+#error "Uma pgina tem de ter 8 blocos (mscara de 8 bits)"
+#endif
+
+void update_init(void);
+uint8_t update_begin(uint8_t slot, uint16_t size, uint16_t crc);
+uint8_t update_block(uint16_t index, uint16_t crc, const uint8_t *data);
+uint8_t update_status(uint8_t first);
+uint8_t update_commit(void);
+void update_poll(void);
+
+#endif /* UPDATE_H_ */